@@ -0,0 +1,26 @@
+#ifndef __BITTY_BOX_DRAWING_HH__
+#define __BITTY_BOX_DRAWING_HH__
+
+#include <optional>
+
+#include "font_renderer.hh"
+#include "util.hh"
+
+namespace bitty {
+// Box drawing (U+2500-U+257F), block elements (U+2580-U+259F) and the
+// Powerline separators (U+E0B0-U+E0BF) are drawn by code at the exact size
+// of a cell rather than taken from the font. Lines meet the cell edges at
+// the same place in every cell, so borders and bars tile without seams, and
+// none of them ever goes through FreeType.
+constexpr bool IsBoxDrawing(char32_t codepoint) {
+  return (codepoint >= 0x2500 && codepoint <= 0x259F) ||
+         (codepoint >= 0xE0B0 && codepoint <= 0xE0BF);
+}
+
+// Coverage bitmap of one cell, positioned like FontRenderer's glyphs. Empty
+// for codepoints IsBoxDrawing() is false for.
+std::optional<GlyphBitmap> DrawBoxGlyph(char32_t codepoint, u32 cell_width,
+                                        u32 cell_height, i32 baseline);
+}  // namespace bitty
+
+#endif /* __BITTY_BOX_DRAWING_HH__ */
@@ -12,7 +12,13 @@ enum CellFlags : uint16_t {
   kItalic = (uint16_t)2,
   kUnderline = (uint16_t)4,
   kStrikethrough = (uint16_t)8,
-  kAll = (uint16_t)(kBold | kItalic | kUnderline | kStrikethrough)
+  kAll = (uint16_t)(kBold | kItalic | kUnderline | kStrikethrough),
+  // Set by the shaper on cells drawn as part of a GlyphCluster, whose id
+  // replaces displayed_code. Never stored in a CellBuffer.
+  kShaped = (uint16_t)0x100,
+  // displayed_code is the id of an interned grapheme cluster, see
+  // grapheme.hh, and true_code its first codepoint
+  kGrapheme = (uint16_t)0x200
 };
 
 union Color {
@@ -19,7 +19,9 @@ namespace bitty {
 class CellBuffer {
   std::vector<ColoredCell> data_;
   u32 width_, pitch_, height_, visible_height_;
-  boost::dynamic_bitset<> dirty_mask_;
+  // One bit per row of the whole buffer, scrollback included, so that
+  // scrolling never invalidates rows that a renderer already holds.
+  boost::dynamic_bitset<> dirty_rows_;
 
   glm::dmat4 transform_;
 
@@ -39,7 +41,7 @@ class CellBuffer {
         visible_height_(visible_height),
         transform_(1) {
     data_ = std::vector<ColoredCell>(pitch_ * height_);
-    dirty_mask_ = boost::dynamic_bitset<>(width_ * visible_height);
+    dirty_rows_ = boost::dynamic_bitset<>(height_);
   }
 
   inline u32 UserScrollInCells() const {
@@ -48,6 +50,8 @@ class CellBuffer {
 
   inline u32 ScrollInCells() const { return scroll_in_cells_; }
 
+  inline u32 UserScrollInPixels() const { return user_scroll_in_pixels_; }
+
   inline std::optional<ColoredCell> Get(u32 x, u32 y,
                                         bool use_user_scroll = false) const {
     y += use_user_scroll ? UserScrollInCells() : ScrollInCells();
@@ -61,7 +65,7 @@ class CellBuffer {
 
     if (x < width_ && y < visible_height_ && Y < height_) {
       data_.at(x + pitch_ * Y) = chr;
-      dirty_mask_[x + width_ * y] = 1;
+      dirty_rows_[Y] = 1;
       return true;
     }
 
@@ -69,13 +73,20 @@ class CellBuffer {
   }
 
   void MarkAllAsDirty();
+  // Marks the graphemes held by cells, scrollback included
+  void MarkGraphemes(std::vector<bool> &live) const;
 
   inline glm::dmat4 GetTransform() const { return transform_; }
 
   inline void SetTransform(glm::dmat4 transform) { transform_ = transform; }
 
-  void ProcessUpdates(std::function<bool(u32, u32, ColoredCell)> func);
-  void EnumerateNonEmptyCells(std::function<bool(u32)> func);
+  // Calls func with the index of every row modified since the last call.
+  // Rows are indexed from the top of the scrollback, not the screen.
+  void ProcessUpdates(std::function<void(u32)> func);
+
+  inline const ColoredCell *RowData(u32 row) const {
+    return data_.data() + pitch_ * row;
+  }
 
   inline u32 Width() const { return width_; }
   inline u32 VisibleHeight() const { return visible_height_; }
@@ -96,6 +107,9 @@ class CellBuffer {
   bool UserScrolledUp() const;
   void UserScrollByNPixels(i32 n);
   void ResetUserScroll();
+  // Keeps the same row at the top of the view after the cell height
+  // changed from old_cell_height
+  void RescaleUserScroll(u32 old_cell_height);
   void ResetScroll();
 
   bool CopyArea(Rect<u32> src, Rect<u32> dest);
@@ -0,0 +1,31 @@
+#ifndef __BITTY_CHAR_WIDTH_HH__
+#define __BITTY_CHAR_WIDTH_HH__
+
+#include "char_width_table.hh"
+#include "util.hh"
+
+namespace bitty {
+// Number of cells codepoint takes, as wcwidth would have it: 2 for East
+// Asian wide characters, 0 for combining and other zero-width characters and
+// 1 otherwise. Independent of the font, so it costs two table loads.
+constexpr u32 CodePointWidth(char32_t codepoint) {
+  using namespace char_width;
+
+  if (codepoint >= kBlockIndex.size() << kBlockBits) return 1;
+
+  u32 offset = codepoint & ((1u << kBlockBits) - 1);
+  u8 packed = kBlocks[(kBlockIndex[codepoint >> kBlockBits]
+                       << (kBlockBits - 2)) +
+                      offset / 4];
+
+  return (packed >> (offset % 4 * 2)) & 3;
+}
+
+static_assert(CodePointWidth(U'a') == 1);
+static_assert(CodePointWidth(U'\u0301') == 0);  // Combining acute accent
+static_assert(CodePointWidth(U'\u200B') == 0);  // Zero width space
+static_assert(CodePointWidth(U'\u4E00') == 2);  // CJK ideograph one
+static_assert(CodePointWidth(U'\U0001F600') == 2);  // Grinning face
+}  // namespace bitty
+
+#endif /* __BITTY_CHAR_WIDTH_HH__ */
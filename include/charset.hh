@@ -5,82 +5,112 @@
 
 #include <boost/container_hash/hash.hpp>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-#include "font_renderer.hh"
-#include "index_alloc.hh"
-#include "tex_coord.hh"
+#include "glyph_atlas.hh"
+#include "glyph_rasterizer.hh"
 
 namespace bitty {
-
-class CharsetBuffer final {
-  std::unique_ptr<u32[]> buffer_;
-  size_t width_px_, height_px_;
-
- public:
-  inline CharsetBuffer() : buffer_(nullptr), width_px_(0), height_px_(0) {}
-  inline CharsetBuffer(size_t width_px, size_t height_px)
-      : buffer_(new u32[width_px * height_px]),
-        width_px_(width_px),
-        height_px_(height_px) {
-    std::memset(buffer_.get(), 0, width_px * height_px * sizeof(u32));
-  }
-
-  bool Render(FT_GlyphSlot glyph, i32 x, i32 y, Cell chr);
-
-  inline u32 *Pixels() { return buffer_.get(); }
-  inline size_t WidthPx() const { return width_px_; }
-  inline size_t HeightPx() const { return height_px_; }
-};
-
+// Maps cells to atlas slots. Ordinary glyphs are coverage only and go into a
+// single channel atlas; color glyphs (emoji) keep their own RGBA atlas, which
+// stays empty until the first one shows up.
+//
+// Slots of the color atlas have kColorSlotBit set, so both fit the 24 bits
+// a cell instance has for them.
+//
+// With a rasterizer started, glyphs seen for the first time are rendered in
+// the background and drawn blank until CommitRasterized() puts them in the
+// atlas.
 class Charset final {
-  bool texture_valid_{false};
-  GLuint texture_id_{0};
-
-  bool changes_pending_upload_{false};
-
-  std::unordered_map<Cell, TexRegion<u32>> char_map_;
-
-  IndexAllocator<u32> char_allocator_;
+ public:
+  constexpr static u32 kInvalidSlot = 0xFFFFFF;
+  constexpr static u32 kColorSlotBit = 1u << 23;
 
-  size_t width_in_chars_, height_in_chars_;
+ private:
+  std::unordered_map<Cell, u32> char_map_;
+  u64 clock_{1}, evictions_{0};
 
-  CharsetBuffer buffer_;
+  GlyphAtlas coverage_, color_;
+  std::vector<Cell> evicted_;
 
-  inline void Reset(size_t width_in_chars, size_t height_in_chars) {
-    const auto &renderer = FontRenderer::Get();
+  std::unique_ptr<GlyphRasterizer> rasterizer_;
+  std::unordered_set<Cell> pending_;
+  u64 arrivals_{0};
 
-    buffer_ = CharsetBuffer(renderer.CellWidthPx() * width_in_chars,
-                            renderer.CellHeightPx() * height_in_chars);
+  inline GlyphAtlas &AtlasOf(u32 slot) {
+    return slot & kColorSlotBit ? color_ : coverage_;
   }
 
-  bool CreateGLTexture();
+  u32 Insert(Cell chr, const std::optional<GlyphBitmap> &glyph);
+  // Shared by graphemes and glyph clusters, which kind tells apart
+  void MarkPending(u16 kind, std::vector<bool> &live) const;
+  void Forget(u16 kind, const std::vector<u32> &ids);
 
  public:
-  Charset(size_t width_in_chars, size_t height_in_chars)
-      : char_allocator_(width_in_chars * height_in_chars),
-        width_in_chars_(width_in_chars),
-        height_in_chars_(height_in_chars) {
-    CreateGLTexture();
-    Reset(width_in_chars, height_in_chars);
+  // Sizes are per page
+  Charset(size_t width_in_chars, size_t height_in_chars);
+
+  // Returns kInvalidSlot for glyphs still being rasterized
+  u32 MapCharacter(Cell chr);
+
+  void StartRasterizer(u32 threads, std::function<void()> on_ready);
+  // Takes over the rasterizer of charset, forgetting what it was working on
+  void AdoptRasterizer(Charset &charset);
+  // Puts glyphs rendered ahead of time in the atlas, unless already there
+  void Preload(const std::vector<GlyphRasterizer::Result> &glyphs);
+  // Adds the glyphs rasterized since the last call to the atlas
+  void CommitRasterized();
+
+  // Fills the atlases with the glyphs SaveCache() wrote last time, unless
+  // the fonts changed since
+  void LoadCache();
+  // Saves the glyphs in the atlases, the most recently used first
+  void SaveCache() const;
+
+  // Marks the graphemes still being rasterized, see SweepGraphemes()
+  inline void MarkGraphemes(std::vector<bool> &live) const {
+    MarkPending(CellFlags::kGrapheme, live);
+  }
+  // Drops the glyphs of freed grapheme ids, which may come back as others
+  inline void ForgetGraphemes(const std::vector<u32> &ids) {
+    Forget(CellFlags::kGrapheme, ids);
+  }
+  // The same for glyph clusters, see SweepGlyphClusters()
+  inline void MarkGlyphClusters(std::vector<bool> &live) const {
+    MarkPending(CellFlags::kShaped, live);
+  }
+  inline void ForgetGlyphClusters(const std::vector<u32> &ids) {
+    Forget(CellFlags::kShaped, ids);
   }
 
-  TexRegion<u32> MapCharacter(Cell chr);
-
-  inline GLint GetGLTexture() {
-    if (!texture_valid_) return -1;
+  inline bool IsPending(Cell chr) const { return pending_.contains(chr); }
+  // Bumped whenever pending glyphs were committed
+  inline u64 Arrivals() const { return arrivals_; }
 
-    return texture_id_;
-  }
+  inline GlyphAtlas &CoverageAtlas() { return coverage_; }
+  inline GlyphAtlas &ColorAtlas() { return color_; }
 
-  inline u32 WidthInChars() const { return width_in_chars_; }
-  inline u32 HeightInChars() const { return height_in_chars_; }
+  // Bumped whenever glyphs are evicted. Slots handed out before may since
+  // hold other glyphs, so everything mapped earlier has to be mapped again.
+  inline u64 Evictions() const { return evictions_; }
 
-  inline u32 TexWidthInPixels() const { return buffer_.WidthPx(); }
-  inline u32 TexHeightInPixels() const { return buffer_.HeightPx(); }
+  // Counts the glyph in slot, as returned by MapCharacter(), as used in this
+  // round
+  inline void Touch(u32 slot) {
+    if (slot != kInvalidSlot)
+      AtlasOf(slot).Touch(slot & ~kColorSlotBit, clock_);
+  }
 
-  bool UploadToGL();
+  inline u64 Round() const { return clock_; }
+  // Ends a round of MapCharacter calls: only glyphs not mapped since the
+  // previous one can be evicted. A round is a frame, every pane and the HUD
+  // included, so that no pane evicts what another one drew.
+  inline void EndRound() { clock_++; }
 };
 }  // namespace bitty
 
-#endif /* __BITTY_IMAGE_BUFFER_HH__ */
\ No newline at end of file
+#endif /* __BITTY_IMAGE_BUFFER_HH__ */
@@ -1,37 +1,102 @@
 #ifndef __BITTY_CONFIG_HH__
 #define __BITTY_CONFIG_HH__
 
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
-#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace bitty {
 class Config;
 
+// $XDG_CONFIG_HOME, or ~/.config without it
+std::filesystem::path GetConfigDirectory();
+// Where bitty keeps its caches: $XDG_CACHE_HOME/bitty or ~/.cache/bitty
+std::filesystem::path GetCacheDirectory();
+
+// Listeners register themselves once fully built, with StartListening() at
+// the end of their constructor, and leave with StopListening() first thing
+// in their destructor. Registering from this base class would let another
+// thread call OnConfigReload() on a half constructed object.
 class ConfigListener {
  public:
-  ConfigListener();
-
   virtual void OnConfigReload() = 0;
 
+  void StartListening();
   void StopListening();
 };
 
+// Every setting of bitty.json, parsed and validated once per reload
+struct Settings {
+  std::optional<std::string> font_family;
+  double font_size{13.0};
+  double opacity{1.0};
+  std::string shell;
+  std::string renderer{"instanced"};
+  // Half period of the cursor blink in milliseconds, 0 disables blinking
+  int cursor_blink_interval{500};
+  // GPU memory the glyph atlas may grow to before evicting glyphs
+  double atlas_memory_limit_mb{64};
+  // Stream glyph uploads through a pixel buffer object
+  bool atlas_pbo{false};
+  // Shape text with HarfBuzz, for the ligatures of fonts like Fira Code
+  bool ligatures{true};
+  // Keep rasterized glyphs on disk between launches
+  bool glyph_cache{true};
+  // Threads rasterizing new glyphs off the render thread, half the cores (1 to
+  // 4) unless set. An explicit 0 rasterizes them while drawing instead
+  unsigned raster_threads{
+      std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u)};
+  // "immediate", "vsync" or "low_latency"
+  std::string present_mode{"immediate"};
+};
+
+// Settings are published as immutable snapshots through an atomic pointer,
+// so the getters take no lock and look nothing up, and can be called every
+// frame. Snapshots are never freed: a reference obtained from Snapshot()
+// stays valid for good, and there are only as many as there were reloads.
+//
+// Reloads only publish a new snapshot. Listeners are notified by
+// NotifyListeners(), which the main thread calls between frames.
 class Config {
-  nlohmann::json json_;
-  std::string default_shell_;
-  mutable std::mutex mutex_;
+  std::atomic<const Settings *> current_{nullptr};
 
+  // Guards everything below, never taken by readers
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<const Settings>> snapshots_;
   std::list<ConfigListener *> listeners_;
 
+  std::thread watcher_;
+  int stop_fd_{-1};
+
   Config();
+  ~Config();
   void operator=(const Config &) = delete;
   Config(const Config &) = delete;
 
  public:
   static Config &Get();
+  // Parses bitty.json again and publishes the result. A file that fails to
+  // parse keeps the current settings, a missing one restores the defaults.
   bool Reload();
 
+  // Reloads whenever bitty.json is written, created, replaced or deleted,
+  // then calls on_change from the watching thread.
+  void Watch(std::function<void()> on_change);
+  // Must be called before whatever on_change uses goes away
+  void StopWatching();
+
+  // Calls OnConfigReload() of every listener, which may read the settings
+  // but not Listen() or StopListening()
+  void NotifyListeners();
+
   inline void Listen(ConfigListener *listener) {
     std::unique_lock lock{mutex_};
     listeners_.push_back(listener);
@@ -42,45 +107,28 @@ class Config {
     listeners_.remove(listener);
   }
 
-  inline std::optional<std::string> FontFamily() const {
-    std::unique_lock lock{mutex_};
-    if (auto ent = json_.find("font_family");
-        ent != json_.end() && ent->is_string())
-      return std::optional{ent->template get<std::string>()};
-    return std::nullopt;
+  inline const Settings &Snapshot() const {
+    return *current_.load(std::memory_order_acquire);
   }
 
-  inline double FontSize() const {
-    std::unique_lock lock{mutex_};
-    if (auto ent = json_.find("font_size");
-        ent != json_.end() && ent->is_number())
-      return ent->template get<double>();
-    return 13.0;
+  inline std::optional<std::string> FontFamily() const {
+    return Snapshot().font_family;
   }
-
-  inline double Opacity() const {
-    std::unique_lock lock{mutex_};
-
-    double opacity;
-
-    if (auto ent = json_.find("opacity");
-        ent != json_.end() && ent->is_number())
-      opacity = ent->template get<double>();
-    else
-      opacity = 1.0;
-
-    return std::clamp(opacity, 0., 1.);
+  inline double FontSize() const { return Snapshot().font_size; }
+  inline double Opacity() const { return Snapshot().opacity; }
+  inline std::string ShellPath() const { return Snapshot().shell; }
+  inline std::string Renderer() const { return Snapshot().renderer; }
+  inline int CursorBlinkInterval() const {
+    return Snapshot().cursor_blink_interval;
   }
-
-  inline std::string ShellPath() const {
-    std::unique_lock lock{mutex_};
-
-    if (auto ent = json_.find("shell");
-        ent != json_.end() && ent->is_string())
-       return *ent;
-    else
-      return default_shell_;
+  inline double AtlasMemoryLimitMb() const {
+    return Snapshot().atlas_memory_limit_mb;
   }
+  inline bool AtlasUploadPbo() const { return Snapshot().atlas_pbo; }
+  inline bool Ligatures() const { return Snapshot().ligatures; }
+  inline bool DiskGlyphCache() const { return Snapshot().glyph_cache; }
+  inline unsigned RasterThreads() const { return Snapshot().raster_threads; }
+  inline std::string PresentMode() const { return Snapshot().present_mode; }
 
   inline double CalcPixelsPerPt() const { return 96.0 / 72.0; }
 };
@@ -33,6 +33,15 @@ struct EventWindowResized {
 
 struct EventWindowRefreshed {};
 
+// Glyphs finished rasterizing in the background and wait to be drawn
+struct EventGlyphsRasterized {};
+
+// The font at a new zoom is loaded and waits to be swapped in
+struct EventFontPrepared {};
+
+// bitty.json changed and a new snapshot of it is published
+struct EventConfigChanged {};
+
 struct EventDataFromTty {
   int terminal_id;
   std::unique_ptr<std::byte[]> bytes;
@@ -41,7 +50,9 @@ struct EventDataFromTty {
 
 using Event = std::variant<EventMouseScroll, EventMouseButton, EventMousePos,
                            EventKeyInput, EventCharInput, EventWindowResized,
-                           EventDataFromTty, EventWindowRefreshed>;
+                           EventDataFromTty, EventWindowRefreshed,
+                           EventGlyphsRasterized, EventFontPrepared,
+                           EventConfigChanged>;
 
 class EventQueue {
   std::mutex mutex_;
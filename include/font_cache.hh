@@ -0,0 +1,45 @@
+#ifndef __BITTY_FONT_CACHE_HH__
+#define __BITTY_FONT_CACHE_HH__
+
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+
+#include "util.hh"
+
+namespace bitty {
+// What fontconfig resolved font patterns to, and the cell widths measured
+// with the files it found, saved across runs in $XDG_CACHE_HOME/bitty.
+//
+// Everything is dropped once fontconfig's own caches or configuration are
+// newer than the saved data, which is when fonts were installed or removed.
+// Entries also remember the modification time of their font file.
+class FontCache {
+  std::mutex mutex_;
+  nlohmann::json json_;
+  bool loaded_{false};
+
+  FontCache() = default;
+  FontCache(const FontCache &) = delete;
+  void operator=(const FontCache &) = delete;
+
+  void Load();
+  void Save();
+
+ public:
+  static FontCache &Get();
+
+  // Latest change to fontconfig's caches or configuration
+  i64 FontconfigStamp();
+
+  std::optional<std::string> File(const std::string &pattern);
+  void SetFile(const std::string &pattern, const std::string &file);
+
+  // In 26.6 fixed point, for file at char_size_266
+  std::optional<i32> CellWidth(const std::string &file, i64 char_size_266);
+  void SetCellWidth(const std::string &file, i64 char_size_266, i32 width);
+};
+}  // namespace bitty
+
+#endif /* __BITTY_FONT_CACHE_HH__ */
@@ -0,0 +1,54 @@
+#ifndef __BITTY_FONT_PRELOADER_HH__
+#define __BITTY_FONT_PRELOADER_HH__
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "cell.hh"
+#include "config.hh"
+#include "glyph_rasterizer.hh"
+
+namespace bitty {
+// Loads another font or size on a thread of its own and renders the cells
+// on screen with it, so that zooming or editing the font in bitty.json does
+// not stall the render thread on face loading, the cell width measurement
+// or a screen full of blank glyphs. The render thread swaps once Take() has
+// a result.
+class FontPreloader {
+ public:
+  struct Prepared {
+    const Settings *settings;
+    double zoom;
+    std::vector<GlyphRasterizer::Result> glyphs;
+  };
+
+ private:
+  std::mutex mutex_;
+  std::optional<Prepared> prepared_;
+  std::atomic<bool> busy_{false};
+  std::thread thread_;
+
+  FontPreloader(const FontPreloader &) = delete;
+  void operator=(const FontPreloader &) = delete;
+
+ public:
+  FontPreloader() = default;
+  ~FontPreloader();
+
+  // From Start() until the result is taken
+  inline bool Busy() const { return busy_; }
+
+  // Must not be Busy(). settings is a Config snapshot, so it outlives the
+  // thread. on_ready is called from the preloading thread once the result
+  // is there.
+  void Start(const Settings &settings, double zoom, std::vector<Cell> cells,
+             std::function<void()> on_ready);
+  std::optional<Prepared> Take();
+};
+}  // namespace bitty
+
+#endif /* __BITTY_FONT_PRELOADER_HH__ */
@@ -5,44 +5,187 @@
 #include <unordered_map>
 #include FT_FREETYPE_H
 
+#include <fontconfig/fontconfig.h>
 #include <harfbuzz/hb.h>
 
+
+#include <array>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "cell.hh"
 #include "config.hh"
 #include "util.hh"
 
 namespace bitty {
-class CharsetBuffer;
+// A rasterized glyph, copied out of the FreeType slot it was rendered into
+struct GlyphBitmap {
+  u32 width{0}, rows{0};
+  i32 left{0}, top{0};  // As bitmap_left and bitmap_top of FT_GlyphSlot
+  bool color{false};    // Premultiplied BGRA if set, 8-bit coverage if not
+  std::vector<u8> pixels;
+};
+
+// A glyph of a shaped run, positions in 26.6 pixels
+struct ShapedGlyph {
+  u32 glyph, cluster;  // cluster is the index of the first character
+  i32 x_advance, x_offset, y_offset;
+};
+
+// Glyphs HarfBuzz substituted for a few cells, such as a ligature, drawn
+// together over those cells. Positions are relative to the left edge of
+// the first cell.
+struct GlyphCluster {
+  struct Glyph {
+    u32 glyph;
+    i32 x, y;  // 26.6
+
+    inline bool operator==(const Glyph &glyph) const = default;
+  };
+
+  bool bold;
+  u16 cells;
+  std::vector<Glyph> glyphs;
+
+  inline bool operator==(const GlyphCluster &cluster) const = default;
+};
+
+// Codepoints missing from the configured font are drawn with the fonts
+// fontconfig suggests as its fallbacks. Which face covers a codepoint is
+// looked up in a two-level page table that is filled a page of 256
+// codepoints at a time, so the lookup is a pair of array reads.
+//
+// The configured font size is scaled by a zoom factor. The per-thread
+// instances of Get() follow the process-wide font set by SetFont(): a
+// counter tells them it changed, and they reload before their next glyph.
+// An instance built for given settings and zoom keeps them, so a new font
+// can be loaded away from the main thread.
+class FontRenderer final {
+  // Face indices in the coverage table: the regular face, then fallbacks_
+  constexpr static u8 kPrimaryFace = 0;
+  constexpr static u8 kNoFace = 0xFF;
+  constexpr static u8 kUnresolved = 0xFE;  // Missing from the regular face
+  constexpr static size_t kMaxFallbacks = 64;
+  constexpr static char32_t kCodepointLimit = 0x110000;
+
+  using CoveragePage = std::array<u8, 256>;
+
+  struct Fallback {
+    std::string file;
+    int index;            // Of the face in the file
+    FcCharSet *charset;   // Owned copy
+    FT_Face face{nullptr};
+    bool failed{false};
+  };
+
+  // Font of the Get() instances, that of the settings the first of them
+  // was built with until SetFont()
+  static inline std::mutex font_mutex_;
+  static inline const Settings *font_settings_{nullptr};
+  static inline double font_zoom_{1.0};
+  static inline std::atomic<u64> font_generation_{1};
 
-class FontRenderer final : public ConfigListener {
   std::mutex mutex_;
   FT_Library library_;
-  FT_Face face_normal_, face_bold_;
+  const Settings *settings_;
+  double zoom_;
+  bool follows_font_;
+  u64 generation_{0};  // Of the font loaded if follows_font_, 0 at first
+  FT_Face face_normal_{nullptr}, face_bold_{nullptr};
+  std::string font_family_, file_normal_, file_bold_;
+  bool bold_failed_{false};
+  i64 char_size_266_{0};
   i32 cell_width_px_{0}, cell_height_px_{0}, baseline_y_;
-  constexpr static size_t kMaxWidthInCellsCacheSize {65536};
-  std::unordered_map<char32_t, uint32_t> width_in_cells_cache_;
+
+  hb_font_t *hb_normal_{nullptr}, *hb_bold_{nullptr};
+  hb_buffer_t *hb_buffer_{nullptr};
+  std::vector<ShapedGlyph> grapheme_glyphs_;
+
+  std::vector<Fallback> fallbacks_;
+  bool fallbacks_resolved_{false};
+  std::array<std::unique_ptr<CoveragePage>, kCodepointLimit / 256> coverage_;
+
   FontRenderer();
+  FontRenderer(const Settings &settings, double zoom, bool follows_font);
 
   FontRenderer(const FontRenderer &) = delete;
   void operator=(const FontRenderer &) = delete;
 
+  // Both expect mutex_ to be held
+  void LoadFaces();
+  // Reloads the faces if SetFont() was called since they were loaded.
+  // Returns whether it did.
+  bool FollowFont();
+
+  std::string FontPattern(bool bold) const;
+  // Through FontCache, and fontconfig if it has no answer
+  std::string ResolveFontFile(bool bold);
+  FT_Face LoadFace(const std::string &file, int index = 0);
+  // Loads the bold face on first use. Falls back to the regular one.
+  FT_Face BoldFace();
+
+  // Asks fontconfig for fallbacks the first time a codepoint is missing
+  void ResolveFallbacks();
+  void ReleaseFallbacks();
+  u8 FaceIndexOf(char32_t codepoint);
+  // The face to draw codepoint with and the glyph in it, 0 if none has it
+  std::pair<FT_Face, FT_UInt> FindGlyph(char32_t codepoint, bool bold);
+
+  hb_font_t *HbFont(bool bold);
+  void ReleaseHbFonts();
+  void ShapeWith(hb_font_t *font, const std::u32string &text,
+                 std::vector<ShapedGlyph> &glyphs);
+  // Draws the glyphs of cluster from face over its cells
+  std::optional<GlyphBitmap> RenderCluster(FT_Face face,
+                                           const GlyphCluster &cluster);
+  // Shapes the codepoints of a kGrapheme cell with the face of the first one
+  std::optional<GlyphBitmap> RenderGrapheme(Cell chr);
+  // Color glyphs are scaled down to fit the cells they span
+  std::optional<GlyphBitmap> RenderGlyphIndex(FT_Face face, FT_UInt glyph_index,
+                                              u32 cells);
+
  public:
   static FontRenderer &Get();
 
-  void OnConfigReload();
+  // A renderer of its own for the font of settings at zoom, which does not
+  // follow SetFont(). Settings are snapshots, which are never freed.
+  FontRenderer(const Settings &settings, double zoom);
+  ~FontRenderer();
+
+  // Has every Get() instance load the font of settings, its size scaled by
+  // zoom. The calling thread's instance reloads at once, the others before
+  // their next glyph.
+  static void SetFont(const Settings &settings, double zoom);
+  // Whether SetFont() was last called with the font and size of settings
+  // at zoom, other settings may differ
+  static bool IsFont(const Settings &settings, double zoom);
 
   inline u32 CellWidthPx() const { return cell_width_px_; }
   inline u32 CellHeightPx() const { return cell_height_px_; }
 
   inline u32 FontBaselineY() const { return baseline_y_; }
 
-  u32 GetCodePointWidthInCells(char32_t codepoint);
-
-  bool RenderCharacter(CharsetBuffer &buf, Cell chr, size_t x, size_t y);
-
-  inline ~FontRenderer() { StopListening(); }
+  // Renders the whole glyph of chr, whichever segment it is. Cells with
+  // CellFlags::kShaped carry the id of a GlyphCluster instead of a
+  // codepoint, those with kGrapheme that of a grapheme cluster.
+  std::optional<GlyphBitmap> RenderGlyph(Cell chr);
+
+  // Whether the regular or bold face substitutes glyphs at all
+  bool HasSubstitutions(bool bold);
+  // Glyph of codepoint in the regular or bold face itself, 0 if missing
+  u32 NominalGlyph(char32_t codepoint, bool bold);
+  // Shapes text with the regular or bold face into glyphs
+  void Shape(const std::u32string &text, bool bold,
+             std::vector<ShapedGlyph> &glyphs);
+
+  // Changes whenever RenderGlyph() could render differently: other font
+  // files, modified ones, or another size
+  u64 CacheKey();
 };
 
 inline u32 GlobalCellWidthPx() { return FontRenderer::Get().CellWidthPx(); }
@@ -0,0 +1,54 @@
+#ifndef __BITTY_FRAME_PACER_HH__
+#define __BITTY_FRAME_PACER_HH__
+
+#include <array>
+#include <string_view>
+
+#include "util.hh"
+
+namespace bitty {
+enum class PresentMode {
+  kImmediate,  // No vsync, every event is drawn right away
+  kVsync,      // Swaps wait for vblank, fewest frames
+  kLowLatency  // Vsync, but frames are started just in time for the vblank
+};
+
+PresentMode ParsePresentMode(std::string_view name);
+
+// Predicts vblanks from the times frames were presented and schedules the
+// start of rendering as late as the recent render times allow, so that input
+// arriving in the meantime still makes it into the next frame.
+//
+// All times are in seconds on one monotonic clock.
+class FramePacer {
+ public:
+  constexpr static size_t kRenderSamples = 32;
+  // Headroom on top of the slowest recent frame
+  constexpr static double kSafetyMargin = 0.0015;
+
+ private:
+  PresentMode mode_;
+  double period_;
+  double last_vblank_{-1};
+  std::array<double, kRenderSamples> render_times_{};
+  size_t render_head_{0};
+
+ public:
+  FramePacer(PresentMode mode, double refresh_rate);
+
+  inline PresentMode Mode() const { return mode_; }
+  inline int SwapInterval() const {
+    return mode_ == PresentMode::kImmediate ? 0 : 1;
+  }
+  inline double Period() const { return period_; }
+
+  // When a frame requested at now should start rendering
+  double RenderStartTime(double now) const;
+
+  // render_time is how long the frame took from the start of rendering to the
+  // swap, presented_at when the swap is known to have completed.
+  void FramePresented(double render_time, double presented_at);
+};
+}  // namespace bitty
+
+#endif /* __BITTY_FRAME_PACER_HH__ */
@@ -0,0 +1,75 @@
+#ifndef __BITTY_FRAME_STATS_HH__
+#define __BITTY_FRAME_STATS_HH__
+
+#include <glad/gl.h>
+
+#include <array>
+#include <chrono>
+
+#include "util.hh"
+
+namespace bitty {
+struct FrameCounters {
+  u64 parse_ns{0}, bytes_parsed{0};
+  u64 cells_updated{0}, vertex_bytes{0}, atlas_bytes{0};
+  u64 cpu_render_ns{0};
+};
+
+// Per-frame counters for the performance HUD. Everything is accumulated into
+// Current() while a frame is built, and EndFrame() moves it to Last().
+//
+// GPU time comes from GL_TIME_ELAPSED queries that are read back a few frames
+// later, so measuring never waits on the GPU. Queries are only issued while
+// the stats are enabled.
+class FrameStats {
+ public:
+  constexpr static size_t kHistorySize = 128;
+  constexpr static size_t kQueryCount = 4;
+  constexpr static size_t kLatencySamples = 256;
+
+ private:
+  FrameCounters current_, last_;
+  u64 gpu_ns_{0};
+  bool enabled_{false}, timing_{false};
+
+  std::array<float, kHistorySize> intervals_ms_{};
+  size_t history_head_{0};
+  std::chrono::steady_clock::time_point last_frame_end_{};
+
+  std::array<GLuint, kQueryCount> queries_{};
+  std::array<bool, kQueryCount> query_pending_{};
+  size_t query_index_{0};
+
+  std::array<float, kLatencySamples> latencies_ms_{};
+  size_t latency_head_{0}, latency_count_{0};
+
+ public:
+  static FrameStats &Get();
+
+  inline bool Enabled() const { return enabled_; }
+  inline void SetEnabled(bool enabled) { enabled_ = enabled; }
+
+  inline FrameCounters &Current() { return current_; }
+  inline const FrameCounters &Last() const { return last_; }
+  inline u64 GpuTimeNs() const { return gpu_ns_; }
+
+  // Interval between the end of a frame and the one before it, age 0 being
+  // the latest.
+  inline float IntervalMs(size_t age) const {
+    return intervals_ms_[(history_head_ + kHistorySize - 1 - age) %
+                         kHistorySize];
+  }
+
+  // Input-to-present latency, recorded whether or not the stats are enabled
+  void RecordLatency(float ms);
+  // p-th percentile (0 to 1) of the recent latencies, 0 without samples
+  float LatencyPercentileMs(float p) const;
+  inline size_t LatencySampleCount() const { return latency_count_; }
+
+  void BeginGpuTimer();
+  void EndGpuTimer();
+  void EndFrame();
+};
+}  // namespace bitty
+
+#endif /* __BITTY_FRAME_STATS_HH__ */
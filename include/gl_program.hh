@@ -3,14 +3,54 @@
 
 #include <glad/gl.h>
 
+#include <array>
+#include <cstddef>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 namespace bitty {
 class GLProgram {
+  // Location and last value of an active uniform. Setting a uniform to the
+  // value it already holds costs no GL call.
+  struct Uniform {
+    GLint location;
+    std::array<std::byte, 64> value{};
+    bool has_value{false};
+
+    template <typename T>
+    inline bool Update(const T &new_value) {
+      static_assert(sizeof(T) <= sizeof(value));
+
+      if (has_value && std::memcmp(value.data(), &new_value, sizeof(T)) == 0)
+        return false;
+
+      std::memcpy(value.data(), &new_value, sizeof(T));
+      has_value = true;
+
+      return true;
+    }
+  };
+
+  struct StringHash {
+    using is_transparent = void;
+
+    inline size_t operator()(std::string_view str) const {
+      return std::hash<std::string_view>{}(str);
+    }
+  };
+
   std::string vertex_str_, frag_str_;
   GLuint program_;
+  std::unordered_map<std::string, Uniform, StringHash, std::equal_to<>>
+      uniforms_;
+
+  static GLuint current_program_;
 
   void PrintShaderLog(GLuint id), PrintProgramLog(GLuint id);
+  void ReflectUniforms();
+  Uniform *FindUniform(std::string_view name);
 
   GLProgram(const GLProgram &) = delete;
   void operator=(const GLProgram &) = delete;
@@ -30,4 +70,4 @@ class GLProgram {
 };
 }  // namespace bitty
 
-#endif /* __BITTY_GL_PROGRAM_HH__ */
\ No newline at end of file
+#endif /* __BITTY_GL_PROGRAM_HH__ */
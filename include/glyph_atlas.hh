@@ -0,0 +1,131 @@
+#ifndef __BITTY_GLYPH_ATLAS_HH__
+#define __BITTY_GLYPH_ATLAS_HH__
+
+#include <glad/gl.h>
+
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "cell.hh"
+#include "font_renderer.hh"
+#include "index_alloc.hh"
+#include "util.hh"
+
+namespace bitty {
+// CPU copy of one atlas page
+class CharsetBuffer final {
+  std::unique_ptr<u8[]> buffer_;
+  size_t width_px_, height_px_, bytes_per_pixel_;
+
+ public:
+  inline CharsetBuffer()
+      : buffer_(nullptr), width_px_(0), height_px_(0), bytes_per_pixel_(0) {}
+  inline CharsetBuffer(size_t width_px, size_t height_px,
+                       size_t bytes_per_pixel)
+      : buffer_(new u8[width_px * height_px * bytes_per_pixel]),
+        width_px_(width_px),
+        height_px_(height_px),
+        bytes_per_pixel_(bytes_per_pixel) {
+    std::memset(buffer_.get(), 0, width_px * height_px * bytes_per_pixel);
+  }
+
+  // Draws the part of glyph that chr's segment covers into the cell at x, y
+  bool Render(const GlyphBitmap &glyph, i32 x, i32 y, Cell chr);
+  void Clear(size_t x, size_t y, size_t width, size_t height);
+  // Between the rectangle at x, y and tightly packed rows of pixels
+  void CopyIn(size_t x, size_t y, size_t width, size_t height, const u8 *src);
+  void CopyOut(size_t x, size_t y, size_t width, size_t height,
+               u8 *dst) const;
+
+  inline u8 *Pixels() { return buffer_.get(); }
+  inline size_t WidthPx() const { return width_px_; }
+  inline size_t HeightPx() const { return height_px_; }
+  inline size_t BytesPerPixel() const { return bytes_per_pixel_; }
+};
+
+// Cell-sized glyph slots on pages of equal size, which are the layers of one
+// GL_TEXTURE_2D_ARRAY. Pages are added as slots are needed, up to a memory
+// limit, after which the slots that went unused the longest are evicted.
+//
+// Slots are numbered row by row across a page, pages one after another.
+class GlyphAtlas {
+  GLenum internal_format_, format_;
+  size_t bytes_per_pixel_;
+
+  GLuint texture_id_{0}, upload_buffer_{0};
+  u32 texture_layers_{0};
+  // Pages up to this one have been uploaded whole once
+  u32 uploaded_pages_{0};
+  bool use_upload_buffer_;
+
+  size_t width_in_chars_, height_in_chars_;
+  u32 max_pages_, max_slots_;
+  bool warned_over_limit_{false};
+
+  IndexAllocator<u32> allocator_;
+  std::vector<std::optional<Cell>> slot_cells_;
+  // Round of MapCharacter calls each slot was last used in
+  std::vector<u64> last_used_;
+
+  std::vector<CharsetBuffer> pages_;
+  std::vector<u32> dirty_slots_;  // Rasterized but not uploaded yet
+
+  GlyphAtlas(const GlyphAtlas &) = delete;
+  void operator=(const GlyphAtlas &) = delete;
+
+  inline u32 SlotsPerPage() const { return width_in_chars_ * height_in_chars_; }
+  // Page of slot and the pixel position of its top left corner on it
+  std::tuple<u32, u32, u32> SlotOrigin(u32 slot) const;
+
+  bool AddPage();
+  bool EvictUnused(u64 round, std::vector<Cell> &evicted);
+  bool GrowTexture();
+  size_t UploadSlots();
+
+ public:
+  GlyphAtlas(GLenum internal_format, GLenum format, size_t bytes_per_pixel,
+             size_t width_in_chars, size_t height_in_chars,
+             size_t memory_limit, u32 max_slots);
+  ~GlyphAtlas();
+
+  // Slots used in round are never evicted. The cells of evicted slots are
+  // appended to evicted.
+  std::optional<u32> Allocate(Cell chr, u64 round, std::vector<Cell> &evicted);
+  inline void Touch(u32 slot, u64 round) { last_used_[slot] = round; }
+  // Empties slot, for Allocate() to hand out again
+  void Free(u32 slot);
+  // Replaces whatever the slot held with glyph, or leaves it blank
+  void Render(u32 slot, const std::optional<GlyphBitmap> &glyph, Cell chr);
+
+  // Whether Allocate() can succeed without evicting anything
+  bool HasRoom() const;
+  // A tile is the cell-sized rectangle of a slot, rows tightly packed
+  inline size_t TileBytes() const {
+    const auto &renderer = FontRenderer::Get();
+    return renderer.CellWidthPx() * renderer.CellHeightPx() * bytes_per_pixel_;
+  }
+  void LoadTile(u32 slot, const u8 *tile);
+  void ReadTile(u32 slot, u8 *tile) const;
+
+  // Calls func(cell, slot) for each slot holding a glyph
+  template <typename F>
+  inline void ForEachGlyph(F func) const {
+    for (u32 slot = 0; slot < slot_cells_.size(); slot++)
+      if (slot_cells_[slot]) func(*slot_cells_[slot], slot);
+  }
+  inline u64 LastUsed(u32 slot) const { return last_used_[slot]; }
+
+  inline GLuint Texture() const { return texture_id_; }
+  inline u32 PageCount() const { return pages_.size(); }
+
+  // Binds the texture to GL_TEXTURE_2D_ARRAY on the active unit if anything
+  // changed, and returns the number of bytes uploaded. The texture may be
+  // replaced by a larger one while doing so.
+  size_t Upload();
+};
+}  // namespace bitty
+
+#endif /* __BITTY_GLYPH_ATLAS_HH__ */
@@ -0,0 +1,49 @@
+#ifndef __BITTY_GLYPH_CACHE_HH__
+#define __BITTY_GLYPH_CACHE_HH__
+
+#include <filesystem>
+#include <vector>
+
+#include "cell.hh"
+#include "util.hh"
+
+namespace bitty {
+// Atlas tiles of rasterized glyphs, kept on disk between launches so that
+// the glyphs of the last session are there before the first frame.
+//
+// The file belongs to one key, which FontRenderer::CacheKey() derives from
+// the font files, their size and the way glyphs are loaded. Any other key
+// finds the file empty, and the next Write() replaces it.
+class GlyphCache {
+ public:
+  struct Entry {
+    Cell chr;
+    bool color;
+    const u8 *tile;  // TileBytes() of the atlas the glyph goes into
+  };
+
+ private:
+  void *mapping_{nullptr};
+  size_t size_{0};
+  std::vector<Entry> entries_;
+
+  GlyphCache(const GlyphCache &) = delete;
+  void operator=(const GlyphCache &) = delete;
+
+ public:
+  // Maps the cache file if it was written for key and the cell size
+  GlyphCache(u64 key, u32 cell_width, u32 cell_height);
+  ~GlyphCache();
+
+  // Point into the mapping, which lives as long as the cache
+  inline const std::vector<Entry> &Entries() const { return entries_; }
+
+  static bool Write(u64 key, u32 cell_width, u32 cell_height,
+                    const std::vector<Entry> &entries);
+
+  // $XDG_CACHE_HOME/bitty/glyphs.bin, or under ~/.cache without it
+  static std::filesystem::path Path();
+};
+}  // namespace bitty
+
+#endif /* __BITTY_GLYPH_CACHE_HH__ */
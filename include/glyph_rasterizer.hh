@@ -0,0 +1,56 @@
+#ifndef __BITTY_GLYPH_RASTERIZER_HH__
+#define __BITTY_GLYPH_RASTERIZER_HH__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "cell.hh"
+#include "font_renderer.hh"
+
+namespace bitty {
+// Pool of threads that rasterize glyphs in the background. FontRenderer is
+// thread_local, so every worker loads FreeType faces of its own and none of
+// them contend with the render thread.
+class GlyphRasterizer {
+ public:
+  struct Result {
+    Cell chr;
+    std::optional<GlyphBitmap> glyph;
+  };
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable requested_;
+  std::deque<Cell> requests_;
+  std::vector<Result> results_;
+  std::function<void()> on_ready_;
+  u64 generation_{0};  // Bumped by Discard()
+  bool stopping_{false};
+  std::vector<std::thread> workers_;
+
+  GlyphRasterizer(const GlyphRasterizer &) = delete;
+  void operator=(const GlyphRasterizer &) = delete;
+
+  void Work();
+
+ public:
+  // on_ready is called from a worker when results become available after
+  // the last TakeResults(), to wake up the render thread.
+  GlyphRasterizer(u32 threads, std::function<void()> on_ready);
+  ~GlyphRasterizer();
+
+  void Request(Cell chr);
+  // Glyphs finished since the previous call, in no particular order
+  std::vector<Result> TakeResults();
+  // Drops every request and result, including glyphs being rasterized
+  // right now, which were meant for a font that is gone
+  void Discard();
+};
+}  // namespace bitty
+
+#endif /* __BITTY_GLYPH_RASTERIZER_HH__ */
@@ -0,0 +1,42 @@
+#ifndef __BITTY_GRAPHEME_HH__
+#define __BITTY_GRAPHEME_HH__
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "util.hh"
+
+namespace bitty {
+// Grapheme clusters of more than one codepoint (a letter and its combining
+// marks, an emoji ZWJ sequence, a flag) do not fit in a Cell. Their cells
+// carry CellFlags::kGrapheme and the id of the cluster's codepoints in
+// displayed_code, true_code keeps the first codepoint.
+//
+// Clusters are interned process-wide, so the same text always gets the same
+// id while any cell holds it. Ids start at 1.
+u32 InternGrapheme(const std::u32string &text);
+// Thread safe, for the rasterizer threads
+std::optional<std::u32string> FindGrapheme(u32 id);
+
+// The table is swept by the main thread once it doubled since the last
+// sweep: the ids cells still hold (and glyphs being rasterized) are marked
+// in live, indexed by id, and the rest is freed. Freed ids are handed out
+// again, so glyphs cached for them have to be forgotten.
+bool GraphemeSweepDue();
+// Returns the ids freed
+std::vector<u32> SweepGraphemes(const std::vector<bool> &live);
+
+inline void MarkGrapheme(std::vector<bool> &live, u32 id) {
+  if (id >= live.size()) live.resize(id + 1);
+  live[id] = true;
+}
+
+// Whether codepoint belongs to the cluster made of text so far, after the
+// rules of UAX #29 that matter in a terminal: combining marks, joiners and
+// variation selectors (any zero-width character), emoji modifiers, emoji
+// ZWJ sequences and regional indicator pairs.
+bool ContinuesGrapheme(const std::u32string &text, char32_t codepoint);
+}  // namespace bitty
+
+#endif /* __BITTY_GRAPHEME_HH__ */
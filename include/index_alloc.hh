@@ -1,6 +1,7 @@
 #ifndef __BITTY_SLAB_ALLOC_HH__
 #define __BITTY_SLAB_ALLOC_HH__
 
+#include <algorithm>
 #include <boost/dynamic_bitset.hpp>
 #include <boost/dynamic_bitset/dynamic_bitset.hpp>
 #include <concepts>
@@ -40,6 +41,24 @@ class IndexAllocator {
     return old_tail;
   }
 
+  // New indices are linked behind the old ones, since the last free entry
+  // always points at the old max_count.
+  inline void Grow(size_t max_count) {
+    if (max_count <= max_count_) return;
+
+    std::unique_ptr<T[]> values(new T[max_count]);
+    std::copy(values_.get(), values_.get() + max_count_, values.get());
+
+    for (size_t i = max_count_; i < max_count; i++) values[i] = i + 1;
+
+    values_ = std::move(values);
+    allocated_set_.resize(max_count);
+    max_count_ = max_count;
+  }
+
+  inline size_t Allocated() const { return allocated_; }
+  inline size_t MaxCount() const { return max_count_; }
+
   inline bool Free(T value) {
     if (allocated_ == 0 || !allocated_set_[value]) return false;
 
@@ -0,0 +1,43 @@
+#ifndef __BITTY_PERF_HUD_HH__
+#define __BITTY_PERF_HUD_HH__
+
+#include <string_view>
+
+#include "cell_buffer.hh"
+#include "render_context.hh"
+#include "retained_frame.hh"
+#include "term_renderer.hh"
+#include "util.hh"
+
+namespace bitty {
+// Overlay in the top right corner of the window showing FrameStats. It is a
+// small CellBuffer drawn by a TermRenderer of its own, so it goes through the
+// same atlas and shaders as the panes and does no work while hidden.
+class PerfHud {
+  constexpr static u32 kWidth = 32, kHeight = 7;
+  constexpr static u32 kGraphRows = 2;
+  // Frame interval that fills the whole graph height
+  constexpr static float kGraphMaxMs = 1000.f / 30;
+
+  CellBuffer buffer_;
+  TermRenderer renderer_;
+  bool visible_{false};
+
+  PerfHud(const PerfHud &) = delete;
+  void operator=(const PerfHud &) = delete;
+
+  void WriteLine(u32 y, std::string_view text);
+  void WriteGraph(u32 top);
+
+ public:
+  PerfHud(RenderContext &context);
+
+  inline bool Visible() const { return visible_; }
+  void Toggle();
+
+  // Draws into the top right corner of frame
+  void Render(RetainedFrame &frame, u32 fb_width, u32 fb_height);
+};
+}  // namespace bitty
+
+#endif /* __BITTY_PERF_HUD_HH__ */
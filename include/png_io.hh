@@ -0,0 +1,25 @@
+#ifndef __BITTY_PNG_IO_HH__
+#define __BITTY_PNG_IO_HH__
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "util.hh"
+
+namespace bitty {
+// 8-bit RGBA pixels, rows from top to bottom
+struct RgbaImage {
+  u32 width{0}, height{0};
+  std::vector<u8> pixels;
+};
+
+// Reads the color buffer of the bound read framebuffer, flipped so that the
+// first row is the top of the frame.
+RgbaImage ReadFramebuffer(u32 width, u32 height);
+
+bool WritePng(const std::string &path, const RgbaImage &image);
+std::optional<RgbaImage> ReadPng(const std::string &path);
+}  // namespace bitty
+
+#endif /* __BITTY_PNG_IO_HH__ */
@@ -0,0 +1,133 @@
+#ifndef __BITTY_RENDER_CONTEXT_HH__
+#define __BITTY_RENDER_CONTEXT_HH__
+
+#include <glad/gl.h>
+
+#include <array>
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <memory>
+
+#include "charset.hh"
+#include "gl_program.hh"
+#include "shaper.hh"
+#include "util.hh"
+
+namespace bitty {
+// One instance per cell. The vertex shader expands it into a quad using the
+// cell size uniforms, so no per-vertex data exists at all.
+struct CellInstance {
+  u16 x, y;
+  u32 glyph;  // Atlas slot in the low 24 bits, CellFlags in the high 8
+  u32 foreground, background;  // Color::raw
+
+  constexpr static u32 kSlotMask = 0xFFFFFF;
+  constexpr static u32 kFlagsShift = 24;
+  // Cells that were never written are culled by the vertex shader.
+  constexpr static u32 kEmptyBit = 1u << 31;
+
+  inline CellInstance()
+      : x(0), y(0), glyph(kEmptyBit), foreground(0), background(0) {}
+
+  inline CellInstance(u32 cell_x, u32 cell_y, u32 slot, const ColoredCell &cell)
+      : x(cell_x),
+        y(cell_y),
+        glyph((slot & kSlotMask) | u32(cell.flags & 0x7F) << kFlagsShift |
+              (cell.displayed_code ? 0 : kEmptyBit)),
+        foreground(cell.foreground.raw),
+        background(cell.background.raw) {}
+};
+
+static_assert(sizeof(CellInstance) == 16);
+
+// Mirrors the std140 Frame block declared by every shader. Each pane keeps
+// one in a small uniform buffer that is only rewritten when it changes.
+struct FrameUniforms {
+  glm::mat4 transform;
+  glm::ivec2 viewport_size;
+  glm::ivec2 cell_size;
+  float opacity;
+  i32 ring_rows, row_offset, scroll_offset;
+};
+
+static_assert(sizeof(FrameUniforms) == 96);
+
+enum class RendererMode {
+  kInstanced,  // One instanced quad per cell
+  kGrid        // Cells in an integer texture, one full-screen fragment pass
+};
+
+// GPU state shared by every pane in the window: the glyph atlas, the shader
+// programs and a vertex array whose instance attribute formats are fixed
+// once, so that each pane only has to bind its own buffer before drawing.
+//
+// Bindings made through the context are cached, so redrawing an unchanged
+// frame does not repeat them.
+class RenderContext {
+ public:
+  constexpr static GLuint kVertexBinding = 0;
+  constexpr static GLuint kFrameUniformBinding = 0;
+  constexpr static GLuint kTextureUnits = 3;
+  // Unit 0 holds the coverage atlas, unit 1 the cell grid of grid mode and
+  // unit 2 the color glyph atlas
+  constexpr static std::array<GLenum, kTextureUnits> kTextureTargets = {
+      GL_TEXTURE_2D_ARRAY, GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY};
+
+ private:
+  GLProgram buf_program_, cursor_program_, grid_program_;
+  GLuint vao_, empty_vao_;
+  std::unique_ptr<Charset> charset_;
+  u64 charset_generation_{0};  // Bumped by ResetCharset()
+  Shaper shaper_;
+  RendererMode mode_;
+
+  GLuint bound_vao_{0}, bound_uniform_buffer_{0}, active_texture_unit_{0};
+  GLuint bound_instance_buffer_{0};
+  GLintptr bound_instance_offset_{0};
+  std::array<GLuint, kTextureUnits> bound_textures_{};
+
+  RenderContext(const RenderContext &) = delete;
+  void operator=(const RenderContext &) = delete;
+
+  bool SetupVertexArray();
+
+ public:
+  RenderContext();
+
+  inline GLProgram &BufProgram() { return buf_program_; }
+  inline GLProgram &CursorProgram() { return cursor_program_; }
+  inline GLProgram &GridProgram() { return grid_program_; }
+  inline Charset &GetCharset() { return *charset_; }
+  inline u64 CharsetGeneration() const { return charset_generation_; }
+  inline Shaper &GetShaper() { return shaper_; }
+  inline GLuint VertexArray() const { return vao_; }
+  // For draws that generate their vertices from gl_VertexID alone
+  inline GLuint EmptyVertexArray() const { return empty_vao_; }
+  inline RendererMode Mode() const { return mode_; }
+
+  void BindVertexArray(GLuint vao);
+  // Binds buffer at offset to kVertexBinding of VertexArray()
+  void BindInstanceBuffer(GLuint buffer, GLintptr offset);
+  void BindFrameUniforms(GLuint buffer);
+  void BindTexture(GLuint unit, GLuint texture);
+  // Also makes the unit active, for glTex* calls that modify the texture
+  void SelectTexture(GLuint unit, GLuint texture);
+  // Must be called before deleting an object that may still be bound
+  void ForgetTexture(GLuint texture);
+  void ForgetBuffer(GLuint buffer);
+
+  // Uploads new glyphs to both atlases
+  void UploadAtlas();
+  // Binds the coverage atlas to unit 0 and the color atlas to unit 2
+  void BindAtlas();
+
+  // Replaces the charset with an empty one sized for the current cells,
+  // keeping its rasterizer, after the font size changed. Slots mapped
+  // before are meaningless afterwards.
+  void ResetCharset();
+  // Frees the glyph clusters neither cached runs nor the charset hold
+  void SweepGlyphClusters();
+};
+}  // namespace bitty
+
+#endif /* __BITTY_RENDER_CONTEXT_HH__ */
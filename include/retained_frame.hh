@@ -0,0 +1,53 @@
+#ifndef __BITTY_RETAINED_FRAME_HH__
+#define __BITTY_RETAINED_FRAME_HH__
+
+#include <glad/gl.h>
+
+#include <array>
+
+#include "util.hh"
+
+namespace bitty {
+// Offscreen color buffer that keeps the whole window between frames. Panes
+// redraw only what changed into it and report the damaged rectangles, and
+// Present() copies just those to the back buffer.
+//
+// The back buffer we copy into may itself be a few frames old, so the damage
+// of the last few frames is remembered and added according to its age.
+class RetainedFrame {
+ public:
+  constexpr static u32 kHistorySize = 4;
+
+ private:
+  GLuint framebuffer_{0}, color_{0};
+  u32 width_{0}, height_{0};
+  Rect<u32> damage_{};  // Top-left origin, empty if Height() == 0
+  std::array<Rect<u32>, kHistorySize> history_{};
+  u32 history_frames_{0};
+
+  RetainedFrame(const RetainedFrame &) = delete;
+  void operator=(const RetainedFrame &) = delete;
+
+  void Release();
+
+ public:
+  RetainedFrame() = default;
+  ~RetainedFrame();
+
+  // Returns true if the storage was recreated, in which case its contents are
+  // undefined and everything has to be drawn again.
+  bool Resize(u32 width, u32 height);
+  void Bind();
+
+  void Damage(Rect<u32> area);
+  inline void DamageAll() { damage_ = Rect<u32>{0, 0, width_, height_}; }
+  inline bool HasDamage() { return damage_.Width() && damage_.Height(); }
+
+  // Copies the damage to the default framebuffer, whose contents are
+  // buffer_age frames old (0 if unknown). Returns false if nothing had to be
+  // copied, and the buffers need not be swapped at all.
+  bool Present(u32 buffer_age);
+};
+}  // namespace bitty
+
+#endif /* __BITTY_RETAINED_FRAME_HH__ */
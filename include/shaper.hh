@@ -0,0 +1,83 @@
+#ifndef __BITTY_SHAPER_HH__
+#define __BITTY_SHAPER_HH__
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cell.hh"
+#include "font_renderer.hh"
+
+namespace bitty {
+// Id of cluster, for cells to carry in displayed_code. Equal clusters get
+// the same id while it is in use.
+u32 InternGlyphCluster(const GlyphCluster &cluster);
+// Thread safe, for the rasterizer threads. Empty once id was freed.
+std::optional<GlyphCluster> FindGlyphCluster(u32 id);
+
+// Clusters are swept like graphemes (see SweepGraphemes()): the ids cached
+// runs and glyphs being rasterized hold are marked in live, the rest freed.
+bool GlyphClusterSweepDue();
+// Returns the ids freed
+std::vector<u32> SweepGlyphClusters(const std::vector<bool> &live);
+
+// Which characters of text the font shaped into glyphs that are not their
+// own: nominal_glyph(codepoint), one per character and not moved. Empty if
+// there are none, or if the run came out right to left.
+std::vector<bool> ChangedCharacters(
+    const std::u32string &text, const std::vector<ShapedGlyph> &glyphs,
+    const std::function<u32(char32_t)> &nominal_glyph);
+
+// Shapes runs of cells in one style with HarfBuzz. Cells that shape to the
+// plain glyphs of their characters are left as they are. Wherever the font
+// substituted glyphs (ligatures, contextual alternates), the cells involved
+// become the segments of a GlyphCluster, drawn like a wide character.
+//
+// Shaped runs are cached by text and style, so reloading a row that was
+// seen before costs a hash lookup.
+class Shaper {
+  struct Segment {
+    u32 cluster;  // 0 if the cell is drawn as is
+    u16 index, count;
+  };
+
+  struct RunKey {
+    std::u32string text;
+    u16 style;
+
+    inline bool operator==(const RunKey &key) const = default;
+  };
+
+  struct RunKeyHash {
+    inline size_t operator()(const RunKey &key) const {
+      size_t result = std::hash<std::u32string>{}(key.text);
+      boost::hash_combine(result, key.style);
+      return result;
+    }
+  };
+
+  constexpr static size_t kMaxCachedRuns = 8192;
+  constexpr static u16 kStyleFlags = CellFlags::kBold | CellFlags::kItalic;
+
+  bool enabled_;
+  // Empty for runs that shaping leaves alone
+  std::unordered_map<RunKey, std::vector<Segment>, RunKeyHash> runs_;
+  std::vector<ShapedGlyph> glyphs_;
+  std::u32string text_;
+
+  std::vector<Segment> ShapeRun(const std::u32string &text, u16 style);
+
+ public:
+  Shaper();
+
+  void ShapeRow(ColoredCell *cells, size_t count);
+  // Forgets every cached run, whose glyph positions depend on the font size
+  inline void Clear() { runs_.clear(); }
+  // Marks the clusters the cached runs hold, see SweepGlyphClusters()
+  void MarkGlyphClusters(std::vector<bool> &live) const;
+};
+}  // namespace bitty
+
+#endif /* __BITTY_SHAPER_HH__ */
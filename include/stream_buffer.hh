@@ -0,0 +1,76 @@
+#ifndef __BITTY_STREAM_BUFFER_HH__
+#define __BITTY_STREAM_BUFFER_HH__
+
+#include <glad/gl.h>
+
+#include <array>
+#include <boost/dynamic_bitset/dynamic_bitset.hpp>
+#include <cstddef>
+
+#include "util.hh"
+
+namespace bitty {
+// A GPU buffer mirroring a CPU-side array that is organized in fixed-size
+// rows. Only rows marked dirty are written on upload.
+//
+// On GL 4.4+ the buffer is allocated with glBufferStorage, mapped once as
+// persistent and coherent, and split into kRegionCount regions that are
+// cycled through every frame. A fence placed after the draw that reads a
+// region guards it from being overwritten while the GPU may still use it.
+// Each region remembers which rows it has not seen yet, so a row changed in
+// one frame is copied into each region exactly once.
+//
+// Older drivers fall back to a single buffer updated with glBufferSubData.
+class StreamingBuffer {
+ public:
+  constexpr static u32 kRegionCount = 3;
+
+ private:
+  GLenum target_;
+  GLuint buffer_{0};
+  bool persistent_{false};
+  std::byte *mapped_{nullptr};
+
+  u32 rows_{0};
+  size_t row_size_{0}, region_size_{0};
+  u32 region_count_{1}, current_{0};
+  size_t last_upload_bytes_{0};
+
+  std::array<GLsync, kRegionCount> fences_{};
+  std::array<boost::dynamic_bitset<>, kRegionCount> stale_rows_;
+
+  StreamingBuffer(const StreamingBuffer &) = delete;
+  void operator=(const StreamingBuffer &) = delete;
+
+  void Release();
+  void WaitForRegion(u32 region);
+
+ public:
+  StreamingBuffer(GLenum target);
+  ~StreamingBuffer();
+
+  // Reallocates storage for `rows` rows of `row_size` bytes each. Every row
+  // of every region is considered stale afterwards.
+  void Resize(u32 rows, size_t row_size);
+
+  void MarkRowsDirty(const boost::dynamic_bitset<> &rows);
+  void MarkAllDirty();
+
+  // Switches to the next region and copies the rows it is missing from
+  // `source`, which must hold Rows() * RowSize() bytes.
+  size_t Upload(const void *source);
+
+  // Must be called once the draw calls sourcing the current region have
+  // been issued.
+  void Fence();
+
+  inline GLuint Id() const { return buffer_; }
+  inline GLintptr Offset() const { return GLintptr(current_ * region_size_); }
+  inline u32 Rows() const { return rows_; }
+  inline size_t RowSize() const { return row_size_; }
+  inline bool IsPersistent() const { return persistent_; }
+  inline size_t LastUploadBytes() const { return last_upload_bytes_; }
+};
+}  // namespace bitty
+
+#endif /* __BITTY_STREAM_BUFFER_HH__ */
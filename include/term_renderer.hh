@@ -1,37 +1,106 @@
 #ifndef __BITTY_BUF_RENDERER_HH__
 #define __BITTY_BUF_RENDERER_HH__
 
+#include <boost/dynamic_bitset/dynamic_bitset.hpp>
+#include <glm/mat4x4.hpp>
 #include <glm/vec2.hpp>
-#include <glm/vec4.hpp>
+#include <optional>
 
-#include "charset.hh"
-#include "gl_program.hh"
+#include "render_context.hh"
+#include "stream_buffer.hh"
 #include "terminal.hh"
 
 namespace bitty {
 class CellBuffer;
 
-struct VertexBufElement {
-  glm::vec4 position;
-  glm::vec2 uv;
-  glm::vec4 foreground, background;
+// Where and how the cursor pass draws, in pane pixels
+struct CursorQuad {
+  glm::vec2 pos, size;
+  u32 glyph;
+  Color foreground, background;
+
+  inline bool operator==(const CursorQuad &cursor) const = default;
 };
 
+// Per-pane renderer. Owns the instance buffer (or, in grid mode, the cell
+// texture) of a single terminal and borrows everything else from the shared
+// RenderContext.
+//
+// GPU rows form a ring indexed by buffer row modulo the ring size, so any kind
+// of scrolling only moves the ring offset and uploads the rows it exposes.
+//
+// The pane is drawn into a framebuffer that keeps its contents between frames,
+// so only rows whose cells changed, that the cursor entered or left, or whose
+// glyphs finished rasterizing, are redrawn. Anything that moves every pixel
+// (scrolling, resizing, a new opacity) repaints the whole pane.
 class TermRenderer {
-  std::vector<VertexBufElement> vbo_data_;
-  std::vector<u32> ibo_data_;
-  GLProgram buf_program_, cursor_program_;
-  GLuint pos_loc_, uv_loc_, fore_loc_, back_loc_, vbo_, ibo_, vao_;
-  Charset charset_;
+  constexpr static i64 kNoRow = -1;
+
+  RenderContext &context_;
+  std::vector<CellInstance> instances_;
+  std::vector<ColoredCell> row_cells_;  // LoadRow scratch, shaped in place
+  StreamingBuffer instance_buffer_;
+  GLuint grid_texture_{0}, frame_buffer_{0};
+  FrameUniforms frame_{};
+  bool frame_valid_{false};
+  Rect<u32> area_{};
+  glm::mat4 xy_to_normalized_{1};
+  u32 grid_width_{0}, ring_rows_{0};
+  std::vector<i64> slot_rows_;  // Buffer row held by each ring slot
+  const CellBuffer *ring_source_{nullptr};
+  u64 atlas_evictions_{0};  // Charset::Evictions() the ring was loaded at
+  u64 atlas_arrivals_{0};   // Charset::Arrivals() the ring was loaded at
+  u64 charset_generation_{0};
+  u64 touched_round_{0};  // Charset::Round() resident rows were touched in
+  boost::dynamic_bitset<> dirty_rows_;    // Ring slots not uploaded yet
+  boost::dynamic_bitset<> pending_rows_;  // Ring slots missing glyphs
+  boost::dynamic_bitset<> damaged_rows_;  // Screen rows to redraw
+  bool full_damage_{true};
+  std::optional<CursorQuad> last_cursor_;
+  size_t last_upload_bytes_{0};
 
-  bool SetupGLBuffers();
-  void AllocateBufferData();
+  TermRenderer(const TermRenderer &) = delete;
+  void operator=(const TermRenderer &) = delete;
+
+  void ResizeGrid(u32 width, u32 ring_rows);
+  void LoadRow(const CellBuffer &buf, u32 row);
+  // Returns whether the uniforms changed
+  bool UpdateFrameUniforms(const FrameUniforms &frame);
+  void UploadRows();
+  void DrawCells();
+  std::optional<CursorQuad> BuildCursor(Terminal &term, const CellBuffer &buf);
+  void DrawCursor(const CursorQuad &cursor);
+  void DamagePixelRows(float top, float bottom);
 
  public:
-  TermRenderer();
+  TermRenderer(RenderContext &context);
+  ~TermRenderer();
+
+  // Draws into area of the bound framebuffer, whose height is fb_height, and
+  // returns the part of it that was redrawn (empty if nothing was).
+  //
+  // cursor_blink_on is the current phase of the blink timer and only
+  // matters if the terminal asked for a blinking cursor.
+  Rect<u32> Render(Terminal &term, Rect<u32> area, u32 fb_height,
+                   bool cursor_blink_on = true);
+
+  // Draws the cells of buf with an optional cursor on top
+  Rect<u32> RenderBuffer(
+      CellBuffer &buf, Rect<u32> area, u32 fb_height,
+      const std::optional<CursorQuad> &cursor = std::nullopt);
+
+  // Keeps the glyphs of the rows resident in the ring from being evicted in
+  // this round, or drops the rows if some of their glyphs were evicted
+  // already. RenderBuffer() does so itself, but panes rendered before it in
+  // the frame may have evicted them by then, so Workspace::Render() touches
+  // every pane first.
+  void TouchResidentRows();
+
+  // Forgets what is on screen, so that the next frame repaints everything
+  inline void Invalidate() { full_damage_ = true; }
 
-  bool Render(Terminal &term, uint32_t window_width, uint32_t window_height);
+  inline size_t LastUploadBytes() const { return last_upload_bytes_; }
 };
 }  // namespace bitty
 
-#endif /* __BITTY_BUF_RENDERER_HH__ */
\ No newline at end of file
+#endif /* __BITTY_BUF_RENDERER_HH__ */
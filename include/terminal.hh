@@ -54,7 +54,7 @@ struct ColorTable256 {
 #define DEF_ESC_HANDLER(name) void Terminal::name(std::vector<Token> tokens)
 #define PTR_ESC_HANDLER &Terminal::
 
-enum class CursorStyle { kBar, kLine };
+enum class CursorStyle { kBlock, kUnderline, kBar };
 
 enum MouseTrackingFormat {
   kNormal,
@@ -85,13 +85,17 @@ class Terminal {
 
   EscapeParser escape_parser_;
   Utf8Parser utf8_parser_;
+  // Codepoints of the last character printed and where its first cell is,
+  // for the ones that continue it. Emptied by anything but a character.
+  std::u32string grapheme_;
+  u32 grapheme_x_{0}, grapheme_y_{0};
   i32 saved_cursor_x_{0}, saved_cursor_y_{0};
   i32 normal_cursor_x_{0}, normal_cursor_y_{0};
   i32 esc_seq_error_counter_{0};
   Color current_fg_{0}, current_bg_{0}, default_fg_{0}, default_bg_{0};
   CellFlags current_cell_flags_{0};
-  CursorStyle cursor_style_ = CursorStyle::kBar;
-  bool is_cursor_visible_{true}, lnm_flag_{false};
+  CursorStyle cursor_style_ = CursorStyle::kBlock;
+  bool is_cursor_visible_{true}, is_cursor_blinking_{true}, lnm_flag_{false};
 
   MouseTrackingFormat mouse_tracking_format_{MouseTrackingFormat::kNormal};
   MouseTrackingMode mouse_mode_{MouseTrackingMode::kNoTracking};
@@ -204,6 +208,7 @@ class Terminal {
   void HandleIndividualModifierForMSequence(u32 mod);
 
   Terminal(const std::string& shell_path, u32 init_w, u32 init_h);
+  Terminal(u32 init_w, u32 init_h);
   Terminal(const Terminal& term) = delete;
   void operator=(const Terminal& term) = delete;
 
@@ -252,6 +257,10 @@ class Terminal {
 
   bool Set(u32 x, u32 y, Cell chr);
 
+  // Adds codepoint to the cluster in grapheme_ and rewrites its cells.
+  // Returns false if the cells were overwritten since, or it does not fit.
+  bool ExtendGrapheme(char32_t codepoint);
+
   void SwitchToAlternateBuffer();
   void SwitchToNormalBuffer();
   bool IsUsingNormalBuffer();
@@ -263,10 +272,6 @@ class Terminal {
     return ColoredCell(Cell(' ', 0), current_fg_, current_bg_);
   }
 
-  inline ColoredCell GetDefaultEmptyCell() {
-    return ColoredCell(Cell(' ', 0), default_fg_, default_bg_);
-  }
-
   Rect<u32> GetDefaultScrollArea();
 
  public:
@@ -275,7 +280,13 @@ class Terminal {
   void SetWindowSize(u32 width, u32 height);
   inline int Id() const { return id_; }
   static int Create(const std::string& shell_path, u32 init_w, u32 init_h);
+  // A terminal without a shell or pty, fed only through InterpretPtyInput.
+  // Anything it would write back to the pty is dropped.
+  static int CreateDetached(u32 init_w, u32 init_h);
+  static void Destroy(int id);
   static std::optional<std::shared_ptr<Terminal>> Get(int id);
+  // Marks the graphemes held by the buffers of every terminal
+  static void MarkGraphemes(std::vector<bool>& live);
 
   inline std::shared_ptr<CellBuffer> CurrentBuffer() { return buf_; }
 
@@ -286,11 +297,20 @@ class Terminal {
 
   bool IsCursorVisible();
 
+  inline CursorStyle GetCursorStyle() const { return cursor_style_; }
+  inline bool IsCursorBlinking() const { return is_cursor_blinking_; }
+
+  inline ColoredCell GetDefaultEmptyCell() {
+    return ColoredCell(Cell(' ', 0), default_fg_, default_bg_);
+  }
+
   void InterpretPtyInput(char byte);
 
   bool TryScrollBufferUp(u32 pixels);
   bool TryScrollBufferDown(u32 pixels);
   bool TryResetUserScroll();
+  // After the font size changed, see CellBuffer::RescaleUserScroll()
+  void RescaleUserScroll(u32 old_cell_height);
   bool IsUserScrolledUp();
 
   void HandleMouseScroll(const EventMouseScroll& event);
@@ -0,0 +1,98 @@
+#ifndef __BITTY_WORKSPACE_HH__
+#define __BITTY_WORKSPACE_HH__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "render_context.hh"
+#include "retained_frame.hh"
+#include "term_renderer.hh"
+#include "terminal.hh"
+#include "util.hh"
+
+namespace bitty {
+// kHorizontal places the two halves side by side, kVertical stacks them.
+enum class SplitDirection { kHorizontal, kVertical };
+
+struct Pane {
+  std::shared_ptr<Terminal> terminal;
+  TermRenderer renderer;
+  Rect<u32> area{};  // In framebuffer pixels, origin at the top left
+  u32 grid_width{0}, grid_height{0};
+
+  inline Pane(std::shared_ptr<Terminal> term, RenderContext &context)
+      : terminal(std::move(term)), renderer(context) {}
+};
+
+struct LayoutNode {
+  std::unique_ptr<Pane> pane;  // Only set for leaves
+  SplitDirection direction{SplitDirection::kHorizontal};
+  std::unique_ptr<LayoutNode> first, second;
+  LayoutNode *parent{nullptr};
+
+  inline bool IsLeaf() const { return pane != nullptr; }
+};
+
+struct Tab {
+  std::unique_ptr<LayoutNode> root;
+  LayoutNode *focused{nullptr};
+};
+
+// Tabs of split panes living in one window. All panes draw through a single
+// RenderContext; panes of hidden tabs keep parsing pty output but are never
+// rendered until their tab is brought to the front.
+class Workspace {
+  RenderContext &context_;
+  std::string shell_path_;
+  std::vector<Tab> tabs_;
+  size_t active_tab_{0};
+  u32 fb_width_{0}, fb_height_{0};
+  // Bumped whenever tabs or splits change or another tab comes to the
+  // front. A root pointer could be freed and handed out again.
+  u64 layout_generation_{1};
+  u64 rendered_generation_{0};  // Of the layout drawn by the last Render
+
+  Workspace(const Workspace &) = delete;
+  void operator=(const Workspace &) = delete;
+
+  std::unique_ptr<LayoutNode> MakeLeaf(u32 width_px, u32 height_px);
+  void LayoutNodeInto(LayoutNode *node, Rect<u32> area);
+  LayoutNode *LeafAt(u32 x, u32 y);
+
+  template <typename T>
+  void ForEachPane(LayoutNode *node, T func);
+
+ public:
+  Workspace(RenderContext &context, std::string shell_path);
+
+  bool NewTab();
+  bool SplitFocused(SplitDirection direction);
+  void CloseFocused();
+  void CycleTab(i32 delta);
+
+  inline bool Empty() const { return tabs_.empty(); }
+  inline size_t TabCount() const { return tabs_.size(); }
+  inline size_t ActiveTabIndex() const { return active_tab_; }
+
+  Pane *FocusedPane();
+  Pane *PaneAt(u32 x, u32 y);
+  bool FocusPaneAt(u32 x, u32 y);
+  bool IsVisible(int terminal_id);
+  bool HasBlinkingCursor();
+
+  // Every distinct cell on screen in the active tab
+  std::vector<Cell> VisibleCells();
+
+  void Layout(u32 fb_width, u32 fb_height);
+  // Lays the panes out again for the current cell size, which was
+  // old_cell_height pixels high before, keeping their scroll positions
+  void RelayoutCells(u32 old_cell_height);
+  // Makes the next Render redraw every visible pane in full
+  void Invalidate();
+  // Redraws the damaged parts of the active tab into frame
+  void Render(RetainedFrame &frame, bool cursor_blink_on = true);
+};
+}  // namespace bitty
+
+#endif /* __BITTY_WORKSPACE_HH__ */
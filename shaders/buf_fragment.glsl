@@ -1,18 +1,49 @@
 #version 440
 
-uniform sampler2D font_texture;
-uniform int cell_width;
+layout(std140, binding = 0) uniform Frame {
+    mat4 transform;
+    ivec2 viewport_size;
+    ivec2 cell_size;
+    float opacity;
+    int ring_rows;
+    int row_offset;
+    int scroll_offset;
+};
 
-in vec2 UV;
+layout(binding = 0) uniform sampler2DArray font_texture;
+layout(binding = 2) uniform sampler2DArray color_texture;
+
+in vec3 UV;
+in vec2 CellPos;
 in vec4 Foreground;
 in vec4 Background;
+flat in uint Flags;
+flat in uint ColorGlyph;
 
 layout(location = 0) out vec4 color;
 
+const uint kUnderline = 4u;
+const uint kStrikethrough = 8u;
+
 void main()
 {
-    vec2 size = textureSize(font_texture, 0);
-    vec2 offset = vec2(1 / size.x, 0);
-    vec4 sample1 = texture(font_texture, UV);
-    color = mix(Background, Foreground, sample1);
+    float line = 0;
+
+    if ((Flags & kUnderline) != 0u && CellPos.y >= cell_size.y - 1)
+        line = 1;
+
+    if ((Flags & kStrikethrough) != 0u &&
+        abs(CellPos.y - cell_size.y / 2.0) < 0.5)
+        line = 1;
+
+    if (ColorGlyph != 0u) {
+        // Premultiplied, so it goes over the background as is
+        vec4 glyph = texture(color_texture, UV);
+
+        color = mix(glyph + Background * (1 - glyph.a), Foreground, line);
+    } else {
+        float coverage = texture(font_texture, UV).r;
+
+        color = mix(Background, Foreground, max(coverage, line));
+    }
 }
@@ -1,19 +1,84 @@
 #version 440
 
-uniform mat4 transform;
-layout(location = 0) in vec4 position;
-layout(location = 1) in vec2 uv;
+layout(std140, binding = 0) uniform Frame {
+    mat4 transform;
+    ivec2 viewport_size;
+    ivec2 cell_size;
+    float opacity;
+    int ring_rows;
+    int row_offset;
+    int scroll_offset;
+};
+
+layout(binding = 0) uniform sampler2DArray font_texture;
+layout(binding = 2) uniform sampler2DArray color_texture;
+
+layout(location = 0) in uvec2 grid_pos;
+layout(location = 1) in uint glyph;
 layout(location = 2) in vec4 foreground;
 layout(location = 3) in vec4 background;
 
-out vec2 UV;
+out vec3 UV;
+out vec2 CellPos;
 out vec4 Foreground;
 out vec4 Background;
+flat out uint Flags;
+flat out uint ColorGlyph;
+
+const uint kSlotMask = 0xFFFFFFu;
+const uint kColorBit = 0x800000u;
+const uint kEmptyBit = 0x80000000u;
 
 void main()
 {
-    gl_Position = transform * position;
-    UV = uv;
-    Foreground = foreground;
-    Background = background;
+    // Cells that were never written collapse into a degenerate quad.
+    if ((glyph & kEmptyBit) != 0u) {
+        gl_Position = vec4(0);
+        return;
+    }
+
+    // Triangle strip corners: (0, 0), (0, 1), (1, 0), (1, 1)
+    vec2 corner = vec2(gl_VertexID >> 1, gl_VertexID & 1);
+    // grid_pos.y is a slot of the row ring; row_offset is the slot shown at
+    // the top of the screen.
+    int row = (int(grid_pos.y) - row_offset + ring_rows) % ring_rows;
+    vec2 pos = (vec2(grid_pos.x, row) + corner) * vec2(cell_size);
+
+    pos.y -= float(scroll_offset);
+
+    gl_Position = transform * vec4(pos, 0, 1);
+
+    uint slot = glyph & kSlotMask;
+    bool invalid = slot == kSlotMask;
+    // Color glyphs have slots of their own atlas
+    bool color_glyph = !invalid && (slot & kColorBit) != 0u;
+    ivec2 atlas_size = color_glyph ? textureSize(color_texture, 0).xy
+                                   : textureSize(font_texture, 0).xy;
+    uvec2 atlas_cells = uvec2(atlas_size / cell_size);
+    uint page_slots = atlas_cells.x * atlas_cells.y;
+
+    ColorGlyph = color_glyph ? 1u : 0u;
+    slot &= ~kColorBit;
+
+    if (invalid || page_slots == 0u) {
+        UV = vec3(-1);
+    } else {
+        // Slots run row by row across a page, then on to the next layer
+        uint page_slot = slot % page_slots;
+        vec2 atlas_cell = vec2(page_slot % atlas_cells.x,
+                               page_slot / atlas_cells.x);
+
+        UV = vec3((atlas_cell + corner) / vec2(atlas_cells),
+                  slot / page_slots);
+    }
+
+    CellPos = corner * vec2(cell_size);
+    Flags = (glyph >> 24) & 0x7Fu;
+
+    // Colors are packed as ARGB in memory order
+    Foreground = foreground.yzwx;
+    Background = background.yzwx;
+
+    if (Background.rgb == vec3(0))
+        Background.a *= opacity;
 }
@@ -1,12 +1,24 @@
 #version 440
 
-uniform sampler2D font_texture;
+layout(binding = 0) uniform sampler2DArray font_texture;
+layout(binding = 2) uniform sampler2DArray color_texture;
 
-in vec4 Color;
+in vec3 UV;
+in vec4 Foreground;
+in vec4 Background;
+flat in uint ColorGlyph;
 
 layout(location = 0) out vec4 color;
 
 void main()
 {
-    color = Color;
+    if (ColorGlyph != 0u) {
+        vec4 glyph = UV.x < 0 ? vec4(0) : texture(color_texture, UV);
+
+        color = glyph + Background * (1 - glyph.a);
+    } else {
+        float coverage = UV.x < 0 ? 0 : texture(font_texture, UV).r;
+
+        color = mix(Background, Foreground, coverage);
+    }
 }
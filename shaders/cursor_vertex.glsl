@@ -1,13 +1,62 @@
 #version 440
 
-uniform mat4 transform;
-layout(location = 0) in vec4 position;
-layout(location = 1) in vec4 color;
+layout(std140, binding = 0) uniform Frame {
+    mat4 transform;
+    ivec2 viewport_size;
+    ivec2 cell_size;
+    float opacity;
+    int ring_rows;
+    int row_offset;
+    int scroll_offset;
+};
 
-out vec4 Color;
+uniform vec2 cursor_pos;
+uniform vec2 cursor_size;
+uniform uint glyph;
+uniform uint foreground;
+uniform uint background;
+layout(binding = 0) uniform sampler2DArray font_texture;
+layout(binding = 2) uniform sampler2DArray color_texture;
+
+out vec3 UV;
+out vec4 Foreground;
+out vec4 Background;
+flat out uint ColorGlyph;
+
+const uint kSlotMask = 0xFFFFFFu;
+const uint kColorBit = 0x800000u;
 
 void main()
 {
-    gl_Position = transform * position;
-    Color = color;
+    // Triangle strip corners: (0, 0), (0, 1), (1, 0), (1, 1)
+    vec2 corner = vec2(gl_VertexID >> 1, gl_VertexID & 1);
+    gl_Position = transform * vec4(cursor_pos + corner * cursor_size, 0, 1);
+
+    uint slot = glyph & kSlotMask;
+    bool invalid = slot == kSlotMask;
+    bool color_glyph = !invalid && (slot & kColorBit) != 0u;
+    ivec2 atlas_size = color_glyph ? textureSize(color_texture, 0).xy
+                                   : textureSize(font_texture, 0).xy;
+    uvec2 atlas_cells = uvec2(atlas_size / cell_size);
+    uint page_slots = atlas_cells.x * atlas_cells.y;
+
+    ColorGlyph = color_glyph ? 1u : 0u;
+    slot &= ~kColorBit;
+
+    // Only the block cursor redraws the glyph under it
+    if (invalid || page_slots == 0u) {
+        UV = vec3(-1);
+    } else {
+        uint page_slot = slot % page_slots;
+        vec2 atlas_cell = vec2(page_slot % atlas_cells.x,
+                               page_slot / atlas_cells.x);
+
+        UV = vec3((atlas_cell + corner * cursor_size / vec2(cell_size)) /
+                      vec2(atlas_cells),
+                  slot / page_slots);
+    }
+
+    // Colors are packed as ARGB in memory order
+    Foreground = unpackUnorm4x8(foreground).yzwx;
+    Background = unpackUnorm4x8(background).yzwx;
 }
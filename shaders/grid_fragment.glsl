@@ -0,0 +1,93 @@
+#version 440
+
+layout(std140, binding = 0) uniform Frame {
+    mat4 transform;
+    ivec2 viewport_size;
+    ivec2 cell_size;
+    float opacity;
+    int ring_rows;
+    int row_offset;
+    int scroll_offset;
+};
+
+layout(binding = 0) uniform sampler2DArray font_texture;
+layout(binding = 1) uniform usampler2D cell_grid;
+layout(binding = 2) uniform sampler2DArray color_texture;
+
+in vec2 PixelPos;
+
+layout(location = 0) out vec4 color;
+
+const uint kSlotMask = 0xFFFFFFu;
+const uint kColorBit = 0x800000u;
+const uint kEmptyBit = 0x80000000u;
+const uint kUnderline = 4u;
+const uint kStrikethrough = 8u;
+
+void main()
+{
+    ivec2 pixel = ivec2(PixelPos) + ivec2(0, scroll_offset);
+    ivec2 cell = pixel / cell_size;
+    ivec2 grid_size = textureSize(cell_grid, 0);
+
+    if (any(greaterThanEqual(cell, grid_size)))
+        discard;
+
+    // Rows of the texture form a ring starting at row_offset
+    ivec2 texel_pos = ivec2(cell.x, (cell.y + row_offset) % grid_size.y);
+
+    // Same layout as CellInstance: position, glyph, foreground, background
+    uvec4 texel = texelFetch(cell_grid, texel_pos, 0);
+    uint glyph = texel.y;
+
+    if ((glyph & kEmptyBit) != 0u)
+        discard;
+
+    vec4 foreground = unpackUnorm4x8(texel.z).yzwx;
+    vec4 background = unpackUnorm4x8(texel.w).yzwx;
+
+    if (background.rgb == vec3(0))
+        background.a *= opacity;
+
+    ivec2 in_cell = pixel - cell * cell_size;
+    uint slot = glyph & kSlotMask;
+    uint flags = (glyph >> 24) & 0x7Fu;
+
+    float coverage = 0;
+    vec4 glyph_color = vec4(0);
+    bool color_glyph = slot != kSlotMask && (slot & kColorBit) != 0u;
+
+    if (slot != kSlotMask) {
+        // Color glyphs have slots of their own atlas
+        ivec2 atlas_size = color_glyph ? textureSize(color_texture, 0).xy
+                                       : textureSize(font_texture, 0).xy;
+        ivec2 atlas_cells = atlas_size / cell_size;
+        int page_slots = atlas_cells.x * atlas_cells.y;
+        int atlas_slot = int(slot & ~kColorBit);
+        int page_slot = atlas_slot % page_slots;
+        ivec2 atlas_cell = ivec2(page_slot % atlas_cells.x,
+                                 page_slot / atlas_cells.x);
+        ivec3 texel = ivec3(atlas_cell * cell_size + in_cell,
+                            atlas_slot / page_slots);
+
+        if (color_glyph)
+            glyph_color = texelFetch(color_texture, texel, 0);
+        else
+            coverage = texelFetch(font_texture, texel, 0).r;
+    }
+
+    float line = 0;
+
+    if ((flags & kUnderline) != 0u && in_cell.y == cell_size.y - 1)
+        line = 1;
+
+    if ((flags & kStrikethrough) != 0u && in_cell.y == cell_size.y / 2)
+        line = 1;
+
+    // Color glyphs are premultiplied, so they go over the background as is
+    if (color_glyph)
+        color = mix(glyph_color + background * (1 - glyph_color.a),
+                    foreground, line);
+    else
+        color = mix(background, foreground, max(coverage, line));
+}
@@ -0,0 +1,24 @@
+#version 440
+
+layout(std140, binding = 0) uniform Frame {
+    mat4 transform;
+    ivec2 viewport_size;
+    ivec2 cell_size;
+    float opacity;
+    int ring_rows;
+    int row_offset;
+    int scroll_offset;
+};
+
+out vec2 PixelPos;
+
+void main()
+{
+    // A single triangle covering the whole viewport
+    vec2 ndc = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2 - 1;
+
+    gl_Position = vec4(ndc, 0, 1);
+
+    // Pixel coordinates with the origin at the top left, like the cell grid
+    PixelPos = vec2(ndc.x + 1, 1 - ndc.y) * 0.5 * vec2(viewport_size);
+}
@@ -0,0 +1,407 @@
+#include "box_drawing.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace bitty {
+namespace {
+enum Weight : u8 { kNone, kLight, kHeavy, kDouble };
+
+// Arms of a line drawing character, two bits each: up, right, down, left
+constexpr u8 Arms(Weight up, Weight right, Weight down, Weight left) {
+  return up | right << 2 | down << 4 | left << 6;
+}
+
+constexpr Weight N = kNone, L = kLight, H = kHeavy, D = kDouble;
+
+// U+2500-U+257F. Dashes, arcs and diagonals are 0 and drawn on their own.
+constexpr std::array<u8, 128> kLineArms = {
+    Arms(N, L, N, L), Arms(N, H, N, H), Arms(L, N, L, N), Arms(H, N, H, N),
+    0, 0, 0, 0, 0, 0, 0, 0,
+    Arms(N, L, L, N), Arms(N, H, L, N), Arms(N, L, H, N), Arms(N, H, H, N),
+    Arms(N, N, L, L), Arms(N, N, L, H), Arms(N, N, H, L), Arms(N, N, H, H),
+    Arms(L, L, N, N), Arms(L, H, N, N), Arms(H, L, N, N), Arms(H, H, N, N),
+    Arms(L, N, N, L), Arms(L, N, N, H), Arms(H, N, N, L), Arms(H, N, N, H),
+    Arms(L, L, L, N), Arms(L, H, L, N), Arms(H, L, L, N), Arms(L, L, H, N),
+    Arms(H, L, H, N), Arms(H, H, L, N), Arms(L, H, H, N), Arms(H, H, H, N),
+    Arms(L, N, L, L), Arms(L, N, L, H), Arms(H, N, L, L), Arms(L, N, H, L),
+    Arms(H, N, H, L), Arms(H, N, L, H), Arms(L, N, H, H), Arms(H, N, H, H),
+    Arms(N, L, L, L), Arms(N, L, L, H), Arms(N, H, L, L), Arms(N, H, L, H),
+    Arms(N, L, H, L), Arms(N, L, H, H), Arms(N, H, H, L), Arms(N, H, H, H),
+    Arms(L, L, N, L), Arms(L, L, N, H), Arms(L, H, N, L), Arms(L, H, N, H),
+    Arms(H, L, N, L), Arms(H, L, N, H), Arms(H, H, N, L), Arms(H, H, N, H),
+    Arms(L, L, L, L), Arms(L, L, L, H), Arms(L, H, L, L), Arms(L, H, L, H),
+    Arms(H, L, L, L), Arms(L, L, H, L), Arms(H, L, H, L), Arms(H, L, L, H),
+    Arms(H, H, L, L), Arms(L, L, H, H), Arms(L, H, H, L), Arms(H, H, L, H),
+    Arms(L, H, H, H), Arms(H, L, H, H), Arms(H, H, H, L), Arms(H, H, H, H),
+    0, 0, 0, 0,
+    Arms(N, D, N, D), Arms(D, N, D, N), Arms(N, D, L, N), Arms(N, L, D, N),
+    Arms(N, D, D, N), Arms(N, N, L, D), Arms(N, N, D, L), Arms(N, N, D, D),
+    Arms(L, D, N, N), Arms(D, L, N, N), Arms(D, D, N, N), Arms(L, N, N, D),
+    Arms(D, N, N, L), Arms(D, N, N, D), Arms(L, D, L, N), Arms(D, L, D, N),
+    Arms(D, D, D, N), Arms(L, N, L, D), Arms(D, N, D, L), Arms(D, N, D, D),
+    Arms(N, D, L, D), Arms(N, L, D, L), Arms(N, D, D, D), Arms(L, D, N, D),
+    Arms(D, L, N, L), Arms(D, D, N, D), Arms(L, D, L, D), Arms(D, L, D, L),
+    Arms(D, D, D, D),
+    0, 0, 0, 0, 0, 0, 0,
+    Arms(N, N, N, L), Arms(L, N, N, N), Arms(N, L, N, N), Arms(N, N, L, N),
+    Arms(N, N, N, H), Arms(H, N, N, N), Arms(N, H, N, N), Arms(N, N, H, N),
+    Arms(N, H, N, L), Arms(L, N, H, N), Arms(N, L, N, H), Arms(H, N, L, N)};
+
+struct Range {
+  i32 start, end;
+};
+
+// Supersampling of the shapes that are not made of whole pixels
+constexpr i32 kSamples = 4;
+
+class Canvas {
+  u32 width_, height_, light_, heavy_;
+  std::vector<u8> pixels_;
+
+ public:
+  inline Canvas(u32 width, u32 height)
+      : width_(width),
+        height_(height),
+        light_(std::max(1u, std::min(width, height) / 8)),
+        heavy_(light_ * 2),
+        pixels_(width * height) {}
+
+  inline u32 Width() const { return width_; }
+  inline u32 Height() const { return height_; }
+  inline u32 Thickness(Weight weight) const {
+    return weight == kHeavy ? heavy_ : light_;
+  }
+
+  inline std::vector<u8> &Pixels() { return pixels_; }
+
+  void Fill(i32 x0, i32 y0, i32 x1, i32 y1, u8 value = 255) {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, i32(width_));
+    y1 = std::min(y1, i32(height_));
+
+    for (i32 y = y0; y < y1; y++)
+      for (i32 x = x0; x < x1; x++) pixels_[y * width_ + x] = value;
+  }
+
+  // Coverage of the area inside(x, y) is true for, x and y in pixels
+  template <typename F>
+  void Shade(F inside) {
+    for (u32 y = 0; y < height_; y++)
+      for (u32 x = 0; x < width_; x++) {
+        u32 hits = 0;
+
+        for (i32 sy = 0; sy < kSamples; sy++)
+          for (i32 sx = 0; sx < kSamples; sx++)
+            hits += inside(x + (sx + .5f) / kSamples,
+                           y + (sy + .5f) / kSamples);
+
+        u8 &pixel = pixels_[y * width_ + x];
+        pixel = std::max<u32>(pixel, hits * 255 / (kSamples * kSamples));
+      }
+  }
+
+  // A stroke of weight across total pixels, centered the same way in every
+  // cell so that it continues into the next one
+  inline Range Single(u32 total, Weight weight) const {
+    i32 thickness = Thickness(weight);
+    i32 start = (i32(total) - thickness) / 2;
+    return {start, start + thickness};
+  }
+
+  // The two lines of a double stroke, a light line apart
+  inline std::pair<Range, Range> Double(u32 total) const {
+    i32 thickness = light_;
+    i32 start = (i32(total) - 3 * thickness) / 2;
+    return {{start, start + thickness},
+            {start + 2 * thickness, start + 3 * thickness}};
+  }
+
+  // Where a stroke of weight lies across total pixels, both lines if double
+  inline Range Extent(u32 total, Weight weight) const {
+    if (weight != kDouble) return Single(total, weight);
+
+    auto [a, b] = Double(total);
+    return {a.start, b.end};
+  }
+};
+
+// Float distance from (x, y) to the segment from (x0, y0) to (x1, y1)
+float SegmentDistance(float x, float y, float x0, float y0, float x1,
+                      float y1) {
+  float dx = x1 - x0, dy = y1 - y0;
+  float t = std::clamp(((x - x0) * dx + (y - y0) * dy) / (dx * dx + dy * dy),
+                       0.f, 1.f);
+
+  return std::hypot(x - x0 - t * dx, y - y0 - t * dy);
+}
+
+// Draws one arm of a line drawing character, from the edge it touches to
+// the junction. before and after are the arms across it: up and down for
+// horizontal arms, left and right for vertical ones.
+//
+// The lines of a double arm stop at the near or far line of a double arm
+// across them, so that corners and junctions of double lines stay open.
+void DrawArm(Canvas &canvas, bool horizontal, bool toward_end, Weight weight,
+             Weight before, Weight after) {
+  u32 along = horizontal ? canvas.Width() : canvas.Height();
+  u32 across = horizontal ? canvas.Height() : canvas.Width();
+
+  auto fill = [&](i32 a0, i32 a1, Range range) {
+    if (horizontal)
+      canvas.Fill(a0, range.start, a1, range.end);
+    else
+      canvas.Fill(range.start, a0, range.end, a1);
+  };
+
+  // The junction along this arm: the strokes across it, or the center
+  Range zone = canvas.Extent(along, weight);
+
+  if (before || after) {
+    zone = {i32(along), 0};
+
+    for (Weight perpendicular : {before, after}) {
+      if (!perpendicular) continue;
+
+      Range extent = canvas.Extent(along, perpendicular);
+      zone = {std::min(zone.start, extent.start),
+              std::max(zone.end, extent.end)};
+    }
+  }
+
+  if (weight != kDouble) {
+    Range range = canvas.Single(across, weight);
+
+    if (toward_end)
+      fill(zone.start, along, range);
+    else
+      fill(0, zone.end, range);
+
+    return;
+  }
+
+  auto [line_a, line_b] = canvas.Double(across);
+  auto [near, far] = canvas.Double(along);
+
+  if (toward_end) {
+    fill(before == kDouble  ? far.start
+         : after == kDouble ? near.start
+                            : zone.start,
+         along, line_a);
+    fill(after == kDouble    ? far.start
+         : before == kDouble ? near.start
+                             : zone.start,
+         along, line_b);
+  } else {
+    fill(0,
+         before == kDouble  ? near.end
+         : after == kDouble ? far.end
+                            : zone.end,
+         line_a);
+    fill(0,
+         after == kDouble    ? near.end
+         : before == kDouble ? far.end
+                             : zone.end,
+         line_b);
+  }
+}
+
+void DrawLines(Canvas &canvas, u8 arms) {
+  auto up = Weight(arms & 3), right = Weight(arms >> 2 & 3),
+       down = Weight(arms >> 4 & 3), left = Weight(arms >> 6 & 3);
+
+  if (up) DrawArm(canvas, false, false, up, left, right);
+  if (right) DrawArm(canvas, true, true, right, up, down);
+  if (down) DrawArm(canvas, false, true, down, left, right);
+  if (left) DrawArm(canvas, true, false, left, up, down);
+}
+
+// Dashes are centered in equal parts of the cell, so the gap between cells
+// matches the gaps inside them
+void DrawDashes(Canvas &canvas, bool horizontal, Weight weight, u32 dashes) {
+  u32 along = horizontal ? canvas.Width() : canvas.Height();
+  u32 across = horizontal ? canvas.Height() : canvas.Width();
+  Range range = canvas.Single(across, weight);
+  i32 gap = std::max(1u, along / dashes / 3);
+
+  for (u32 i = 0; i < dashes; i++) {
+    i32 start = i * along / dashes + gap / 2;
+    i32 end = (i + 1) * along / dashes - (gap - gap / 2);
+
+    if (horizontal)
+      canvas.Fill(start, range.start, end, range.end);
+    else
+      canvas.Fill(range.start, start, range.end, end);
+  }
+}
+
+// Rounded corners joining the middle of two adjacent edges. right and down
+// tell which edges.
+void DrawArc(Canvas &canvas, bool right, bool down) {
+  Range x_range = canvas.Single(canvas.Width(), kLight);
+  Range y_range = canvas.Single(canvas.Height(), kLight);
+  float thickness = x_range.end - x_range.start;
+  float cx = (x_range.start + x_range.end) / 2.f;
+  float cy = (y_range.start + y_range.end) / 2.f;
+
+  float radius = std::min(right ? canvas.Width() - cx : cx,
+                          down ? canvas.Height() - cy : cy);
+  float center_x = cx + (right ? radius : -radius);
+  float center_y = cy + (down ? radius : -radius);
+
+  canvas.Shade([&](float x, float y) {
+    bool in_x = right ? x < center_x : x > center_x;
+    bool in_y = down ? y < center_y : y > center_y;
+
+    if (in_x && in_y)
+      return std::abs(std::hypot(x - center_x, y - center_y) - radius) <=
+             thickness / 2;
+
+    return false;
+  });
+
+  // Straight on to the edges the circle did not reach
+  if (right)
+    canvas.Fill(std::floor(center_x), y_range.start, canvas.Width(),
+                y_range.end);
+  else
+    canvas.Fill(0, y_range.start, std::ceil(center_x), y_range.end);
+
+  if (down)
+    canvas.Fill(x_range.start, std::floor(center_y), x_range.end,
+                canvas.Height());
+  else
+    canvas.Fill(x_range.start, 0, x_range.end, std::ceil(center_y));
+}
+
+void DrawDiagonals(Canvas &canvas, bool rising, bool falling) {
+  float w = canvas.Width(), h = canvas.Height();
+  float half = canvas.Thickness(kLight) / 2.f;
+
+  canvas.Shade([&](float x, float y) {
+    return (rising && SegmentDistance(x, y, w, 0, 0, h) <= half) ||
+           (falling && SegmentDistance(x, y, 0, 0, w, h) <= half);
+  });
+}
+
+void DrawBlock(Canvas &canvas, char32_t codepoint) {
+  i32 w = canvas.Width(), h = canvas.Height();
+
+  auto eighths = [](i32 total, i32 n) { return (total * n + 4) / 8; };
+
+  // Bits 1, 2, 4 and 8 are the upper left, upper right, lower left and lower
+  // right quadrants
+  constexpr std::array<u8, 10> kQuadrants = {4, 8, 1, 1 | 4 | 8, 1 | 8,
+                                             1 | 2 | 4, 1 | 2 | 8, 2, 2 | 4,
+                                             2 | 4 | 8};
+
+  if (codepoint == 0x2580)
+    canvas.Fill(0, 0, w, h / 2);
+  else if (codepoint <= 0x2588)
+    canvas.Fill(0, h - eighths(h, codepoint - 0x2580), w, h);
+  else if (codepoint <= 0x258F)
+    canvas.Fill(0, 0, eighths(w, 0x2590 - codepoint), h);
+  else if (codepoint == 0x2590)
+    canvas.Fill(w / 2, 0, w, h);
+  else if (codepoint <= 0x2593)
+    canvas.Fill(0, 0, w, h, (codepoint - 0x2590) * 64);
+  else if (codepoint == 0x2594)
+    canvas.Fill(0, 0, w, eighths(h, 1));
+  else if (codepoint == 0x2595)
+    canvas.Fill(w - eighths(w, 1), 0, w, h);
+  else {
+    u8 quadrants = kQuadrants[codepoint - 0x2596];
+
+    if (quadrants & 1) canvas.Fill(0, 0, w / 2, h / 2);
+    if (quadrants & 2) canvas.Fill(w / 2, 0, w, h / 2);
+    if (quadrants & 4) canvas.Fill(0, h / 2, w / 2, h);
+    if (quadrants & 8) canvas.Fill(w / 2, h / 2, w, h);
+  }
+}
+
+// Arrows, half circles and corner triangles, solid or as outlines. The odd
+// codepoints of the range are the outlines.
+void DrawPowerline(Canvas &canvas, char32_t codepoint) {
+  float w = canvas.Width(), h = canvas.Height();
+  float half = canvas.Thickness(kLight) / 2.f;
+  bool outline = codepoint & 1;
+  u32 shape = (codepoint - 0xE0B0) / 2;
+
+  // Arrows and half circles point right unless mirrored
+  bool mirror = shape == 1 || shape == 3;
+
+  canvas.Shade([&](float x, float y) {
+    if (mirror) x = w - x;
+
+    switch (shape) {
+      case 0:
+      case 1:
+        if (outline)
+          return SegmentDistance(x, y, 0, 0, w, h / 2) <= half ||
+                 SegmentDistance(x, y, w, h / 2, 0, h) <= half;
+
+        return x <= w * (1 - std::abs(2 * y / h - 1));
+      case 2:
+      case 3: {
+        float dx = x / w, dy = 2 * y / h - 1;
+        float distance = std::hypot(dx, dy);
+
+        if (outline)
+          return std::abs(distance - 1) * std::min(w, h / 2) <= half;
+
+        return distance <= 1;
+      }
+      // Lower left, lower right, upper left and upper right triangles
+      case 4:
+        return outline ? SegmentDistance(x, y, 0, 0, w, h) <= half
+                       : y >= h * x / w;
+      case 5:
+        return outline ? SegmentDistance(x, y, w, 0, 0, h) <= half
+                       : y >= h * (1 - x / w);
+      case 6:
+        return outline ? SegmentDistance(x, y, w, 0, 0, h) <= half
+                       : y <= h * (1 - x / w);
+      default:
+        return outline ? SegmentDistance(x, y, 0, 0, w, h) <= half
+                       : y <= h * x / w;
+    }
+  });
+}
+}  // namespace
+
+std::optional<GlyphBitmap> DrawBoxGlyph(char32_t codepoint, u32 cell_width,
+                                        u32 cell_height, i32 baseline) {
+  if (!IsBoxDrawing(codepoint) || !cell_width || !cell_height)
+    return std::nullopt;
+
+  Canvas canvas(cell_width, cell_height);
+
+  if (codepoint >= 0xE0B0)
+    DrawPowerline(canvas, codepoint);
+  else if (codepoint >= 0x2580)
+    DrawBlock(canvas, codepoint);
+  else if (u8 arms = kLineArms[codepoint - 0x2500])
+    DrawLines(canvas, arms);
+  else if (codepoint <= 0x250B)
+    DrawDashes(canvas, !(codepoint & 2), codepoint & 1 ? kHeavy : kLight,
+               codepoint < 0x2508 ? 3 : 4);
+  else if (codepoint <= 0x254F)
+    DrawDashes(canvas, !(codepoint & 2), codepoint & 1 ? kHeavy : kLight, 2);
+  else if (codepoint <= 0x2570)
+    DrawArc(canvas, codepoint == 0x256D || codepoint == 0x2570,
+            codepoint <= 0x256E);
+  else
+    DrawDiagonals(canvas, codepoint != 0x2572, codepoint != 0x2571);
+
+  GlyphBitmap glyph;
+  glyph.width = cell_width;
+  glyph.rows = cell_height;
+  glyph.left = 0;
+  glyph.top = baseline;
+  glyph.pixels = std::move(canvas.Pixels());
+
+  return glyph;
+}
+}  // namespace bitty
@@ -5,6 +5,7 @@
 
 #include "cell.hh"
 #include "font_renderer.hh"
+#include "grapheme.hh"
 #include "util.hh"
 
 namespace bitty {
@@ -13,13 +14,18 @@ bool CellBuffer::UserScrolledUp() const {
   return UserScrollInCells() != ScrollInCells();
 }
 
-void CellBuffer::MarkAllAsDirty() { dirty_mask_.set(); }
+void CellBuffer::MarkAllAsDirty() { dirty_rows_.set(); }
+
+void CellBuffer::MarkGraphemes(std::vector<bool> &live) const {
+  for (const ColoredCell &chr : data_)
+    if (chr.flags & CellFlags::kGrapheme)
+      MarkGrapheme(live, chr.displayed_code);
+}
 
 void CellBuffer::UserScrollByNPixels(i32 n) {
   user_scroll_in_pixels_ =
       std::min(i32(HistorySizeInCells() * GlobalCellHeightPx()),
                std::max(0, user_scroll_in_pixels_ + n));
-  MarkAllAsDirty();
 }
 
 void CellBuffer::ScrollByNCells(i32 n, bool allow_buf_expansion) {
@@ -37,6 +43,7 @@ void CellBuffer::ScrollByNCells(i32 n, bool allow_buf_expansion) {
     height_ += added_cells;
 
     data_.resize(pitch_ * height_);
+    dirty_rows_.resize(height_, true);
   }
 
   if (!UserScrolledUp()) UserScrollByNPixels(n * (i32)GlobalCellHeightPx());
@@ -46,7 +53,11 @@ void CellBuffer::ScrollByNCells(i32 n, bool allow_buf_expansion) {
 
 void CellBuffer::ResetUserScroll() {
   user_scroll_in_pixels_ = scroll_in_cells_ * GlobalCellHeightPx();
-  MarkAllAsDirty();
+}
+
+void CellBuffer::RescaleUserScroll(u32 old_cell_height) {
+  user_scroll_in_pixels_ =
+      i64(user_scroll_in_pixels_) * GlobalCellHeightPx() / old_cell_height;
 }
 
 void CellBuffer::ResetScroll() { scroll_in_cells_ = HistorySizeInCells(); }
@@ -71,8 +82,7 @@ bool CellBuffer::CopyArea(Rect<u32> src, Rect<u32> dest) {
       src.Height() != dest.Height())
     return false;
 
-  for (u32 y = 0; y < h; y++)
-    dirty_mask_.set(dest.left + width_ * (dest.top + y), w, 1);
+  dirty_rows_.set(ScrollInCells() + dest.top, h, 1);
 
   if (src.top > dest.top) {
     // Copy goes from top to bottom
@@ -100,14 +110,14 @@ bool CellBuffer::FillLine(u32 left, u32 right, u32 y, ColoredCell value) {
 
   ColoredCell *base = data_.data() + offset;
 
-  dirty_mask_.set(y * width_ + left, right - left, 1);
+  dirty_rows_[y + ScrollInCells()] = 1;
 
   for (u32 x = left; x < right; x++) base[x] = value;
 
   return true;
 }
 
-void CellBuffer::ResetUpdates() { dirty_mask_.reset(); }
+void CellBuffer::ResetUpdates() { dirty_rows_.reset(); }
 
 bool CellBuffer::FillArea(Rect<u32> area, ColoredCell value) {
   if (!area.IsValid()) return false;
@@ -121,45 +131,23 @@ bool CellBuffer::FillArea(Rect<u32> area, ColoredCell value) {
 
   ColoredCell *base = data_.data() + offset;
 
-  for (u32 y = area.top; y < area.bottom; y++) {
+  for (u32 y = area.top; y < area.bottom; y++)
     for (u32 x = area.left; x < area.right; x++) base[x + pitch_ * y] = value;
 
-    dirty_mask_.set(area.left + width_ * y, area.right - area.left, 1);
-  }
+  if (area.IsValid())
+    dirty_rows_.set(ScrollInCells() + area.top, area.Height(), 1);
 
   return true;
 }
 
-void CellBuffer::ProcessUpdates(
-    std::function<bool(u32, u32, ColoredCell)> func) {
-  size_t updated = dirty_mask_.find_first();
-
-  u32 x = 0, y = 0;
-
-  u32 scroll = UserScrollInCells();
-
-  while (updated != boost::dynamic_bitset<>::npos) {
-    x = updated % width_;
-    y = updated / width_;
-
-    if (y + scroll >= height_) break;
-
-    if (const auto &cell = data_.at(x + y * pitch_ + scroll * pitch_);
-        cell.displayed_code)
-      func(x, y, cell);
-
-    updated = dirty_mask_.find_next(updated);
-  }
+void CellBuffer::ProcessUpdates(std::function<void(u32)> func) {
+  for (size_t row = dirty_rows_.find_first(); row != dirty_rows_.npos;
+       row = dirty_rows_.find_next(row))
+    func(row);
 
   ResetUpdates();
 }
 
-void CellBuffer::EnumerateNonEmptyCells(std::function<bool(u32)> func) {
-  for (u32 i = UserScrollInCells(), j = VisibleHeight(), k = 0; k < j; k++)
-    for (u32 x = 0; x < Width(); x++)
-      if (data_.at((i + k) * pitch_ + x).displayed_code) func(k * width_ + x);
-}
-
 std::pair<i32, i32> CellBuffer::Resize(u32 width, u32 height) {
   if (width == width_ && height == height_) return {0, 0};
 
@@ -185,7 +173,7 @@ std::pair<i32, i32> CellBuffer::Resize(u32 width, u32 height) {
   if (width_ > pitch_) pitch_ = ExpGrowSize(width_), grow_pitch = true;
 
   data_.resize(pitch_ * height_);
-  dirty_mask_.resize(width_ * visible_height_);
+  dirty_rows_.resize(height_);
 
   if (grow_pitch) {
     for (u32 h = 0; h < height_; h++) {
@@ -1,121 +1,211 @@
 #include "charset.hh"
 
-#include <GL/glext.h>
-#include <freetype/ftimage.h>
 #include <glad/gl.h>
 
-#include "cell_buffer.hh"
+#include <algorithm>
+#include <utility>
+
+#include "box_drawing.hh"
+#include "config.hh"
 #include "font_renderer.hh"
+#include "glyph_cache.hh"
+#include "grapheme.hh"
 #include "util.hh"
 
 namespace bitty {
-bool CharsetBuffer::Render(FT_GlyphSlot glyph, i32 x, i32 y, Cell chr) {
-  FT_Bitmap *bmp = &glyph->bitmap;
+namespace {
+size_t AtlasMemoryLimit() {
+  return Config::Get().AtlasMemoryLimitMb() * 1024 * 1024;
+}
+}  // namespace
+
+// Color glyphs are rare in a terminal, so they get a quarter of the budget
+Charset::Charset(size_t width_in_chars, size_t height_in_chars)
+    : coverage_(GL_R8, GL_RED, 1, width_in_chars, height_in_chars,
+                AtlasMemoryLimit() / 4 * 3, kColorSlotBit - 1),
+      color_(GL_RGBA8, GL_BGRA, 4, width_in_chars, height_in_chars,
+             AtlasMemoryLimit() / 4, kColorSlotBit - 1) {}
 
-  const auto &renderer = FontRenderer::Get();
+u32 Charset::Insert(Cell chr, const std::optional<GlyphBitmap> &glyph) {
+  bool color = glyph && glyph->color;
+  GlyphAtlas &atlas = color ? color_ : coverage_;
 
-  i32 x_offset = glyph->bitmap_left;
+  std::optional<u32> slot = atlas.Allocate(chr, clock_, evicted_);
 
-  i32 y_offset =
-      renderer.FontBaselineY() -
-      glyph->bitmap_top;  // renderer.FontBaselineY() -
-                          // FloorFrom266(glyph->metrics.horiBearingY);
+  if (!evicted_.empty()) {
+    for (Cell cell : evicted_) char_map_.erase(cell);
+
+    evicted_.clear();
+    evictions_++;
+  }
 
-  enum { R = 0, G, B, kBytesPerPixel = 1 };
-  u32 actual_width = bmp->width / kBytesPerPixel;
+  if (!slot) return kInvalidSlot;
 
-  u32 segment_offset = chr.segment_index * renderer.CellWidthPx();
+  atlas.Render(*slot, glyph, chr);
 
-  i32 right_border = x + renderer.CellWidthPx();
-  i32 bottom_border = y + renderer.CellHeightPx();
+  u32 idx = *slot | (color ? kColorSlotBit : 0);
+  char_map_[chr] = idx;
 
-  for (u32 Y = 0; Y < bmp->rows; Y++) {
-    for (u32 X = 0; X < actual_width; X++) {
-      if (auto x_inside_bmp = X + segment_offset; x_inside_bmp < actual_width) {
-        uint8_t *pix = (uint8_t *)bmp->buffer + x_inside_bmp * kBytesPerPixel +
-                       bmp->pitch * Y;
+  return idx;
+}
 
-        i32 total_x = X + x + x_offset;
-        i32 total_y = Y + y + y_offset;
+u32 Charset::MapCharacter(Cell chr) {
+  if (auto found = char_map_.find(chr); found != char_map_.end()) {
+    AtlasOf(found->second).Touch(found->second & ~kColorSlotBit, clock_);
+    return found->second;
+  }
 
-        if (total_x >= x && total_y >= y && total_x < right_border &&
-            total_y < bottom_border) {
-          uint8_t chan = pix[0];
-          auto value = chan << 24 | chan << 16 | chan << 8 | chan;
+  // Cheaper to draw than to queue, and never pending
+  if (IsBoxDrawing(chr.displayed_code) &&
+      !(chr.flags & (CellFlags::kShaped | CellFlags::kGrapheme))) {
+    auto &renderer = FontRenderer::Get();
 
-          buffer_[total_x + total_y * width_px_] = value;
-        }
-      }
-    }
+    return Insert(chr, DrawBoxGlyph(chr.displayed_code, renderer.CellWidthPx(),
+                                    renderer.CellHeightPx(),
+                                    renderer.FontBaselineY()));
   }
 
-  return true;
+  if (rasterizer_) {
+    if (pending_.insert(chr).second) rasterizer_->Request(chr);
+
+    return kInvalidSlot;
+  }
+
+  u32 idx = Insert(chr, FontRenderer::Get().RenderGlyph(chr));
+
+  if (idx == kInvalidSlot) return kInvalidSlot;
+
+  // Copies keep true_code, which the cells of a cluster do not share with
+  // displayed_code
+  for (uint16_t seg = 0; seg < chr.segment_count; seg++) {
+    if (seg == chr.segment_index) continue;
+
+    Cell segment = chr;
+    segment.segment_index = seg;
+    MapCharacter(segment);
+  }
+
+  return idx;
+}
+
+void Charset::StartRasterizer(u32 threads, std::function<void()> on_ready) {
+  rasterizer_ = std::make_unique<GlyphRasterizer>(threads, std::move(on_ready));
 }
 
-bool Charset::CreateGLTexture() {
-  glGenTextures(1, &texture_id_);
+void Charset::AdoptRasterizer(Charset &charset) {
+  rasterizer_ = std::move(charset.rasterizer_);
+  charset.pending_.clear();
 
-  texture_valid_ = true;
+  if (rasterizer_) rasterizer_->Discard();
+}
 
-  return true;
+void Charset::Preload(const std::vector<GlyphRasterizer::Result> &glyphs) {
+  for (const auto &[chr, glyph] : glyphs)
+    if (!char_map_.contains(chr)) Insert(chr, glyph);
 }
 
-bool Charset::UploadToGL() {
-  if (!texture_valid_) CreateGLTexture();
+void Charset::CommitRasterized() {
+  if (!rasterizer_) return;
 
-  if (changes_pending_upload_) {
-    glBindTexture(GL_TEXTURE_2D, texture_id_);
+  std::vector<GlyphRasterizer::Result> results = rasterizer_->TakeResults();
 
-    const auto &renderer = FontRenderer::Get();
+  if (results.empty()) return;
 
-    size_t tex_width = width_in_chars_ * renderer.CellWidthPx();
-    size_t tex_height = height_in_chars_ * renderer.CellHeightPx();
+  for (auto &[chr, glyph] : results) {
+    pending_.erase(chr);
+    Insert(chr, glyph);
+  }
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, tex_height, 0, GL_BGRA,
-                 GL_UNSIGNED_BYTE, buffer_.Pixels());
+  arrivals_++;
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+void Charset::MarkPending(u16 kind, std::vector<bool> &live) const {
+  for (Cell chr : pending_)
+    if (chr.flags & kind) MarkGrapheme(live, chr.displayed_code);
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+void Charset::Forget(u16 kind, const std::vector<u32> &ids) {
+  if (ids.empty()) return;
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  std::unordered_set<u32> freed(ids.begin(), ids.end());
 
-    float color[4] = {};
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, color);
-  }
+  std::erase_if(char_map_, [&](const auto &entry) {
+    const auto &[chr, slot] = entry;
+
+    if (!(chr.flags & kind) || !freed.contains(chr.displayed_code))
+      return false;
 
-  changes_pending_upload_ = false;
+    AtlasOf(slot).Free(slot & ~kColorSlotBit);
+    return true;
+  });
 
-  return true;
+  // Their slots are handed out again
+  evictions_++;
 }
 
-TexRegion<u32> Charset::MapCharacter(Cell chr) {
-  if (auto found = char_map_.find(chr); found != char_map_.end())
-    return found->second;
+void Charset::LoadCache() {
+  auto &renderer = FontRenderer::Get();
+
+  GlyphCache cache(renderer.CacheKey(), renderer.CellWidthPx(),
+                   renderer.CellHeightPx());
+
+  size_t loaded = 0;
+
+  for (const GlyphCache::Entry &entry : cache.Entries()) {
+    GlyphAtlas &atlas = entry.color ? color_ : coverage_;
 
+    // Never evicts, the glyphs saved first were the last ones used
+    if (char_map_.contains(entry.chr) || !atlas.HasRoom()) continue;
+
+    std::optional<u32> slot = atlas.Allocate(entry.chr, clock_, evicted_);
+    if (!slot) continue;
+
+    atlas.LoadTile(*slot, entry.tile);
+    char_map_[entry.chr] = *slot | (entry.color ? kColorSlotBit : 0);
+    loaded++;
+  }
+
+  if (loaded) LogInfo() << "Loaded " << loaded << " glyphs from the cache\n";
+}
+
+void Charset::SaveCache() const {
   auto &renderer = FontRenderer::Get();
 
-  u32 idx = char_allocator_.Allocate().value_or(-1u);
+  struct Saved {
+    Cell chr;
+    bool color;
+    u64 last_used;
+    size_t offset;
+  };
+
+  std::vector<Saved> saved;
+  std::vector<u8> tiles;
 
-  if (idx == -1u) return TexRegion<u32>{{0u, 0u}, {0u, 0u}};
+  for (const GlyphAtlas *atlas : {&coverage_, &color_}) {
+    bool color = atlas == &color_;
 
-  u32 x_in_chars = idx % width_in_chars_;
-  u32 y_in_chars = idx / width_in_chars_;
+    atlas->ForEachGlyph([&](Cell chr, u32 slot) {
+      // Cluster ids are only meaningful to the process that interned them
+      if (chr.flags & (CellFlags::kShaped | CellFlags::kGrapheme)) return;
 
-  u32 x = x_in_chars * renderer.CellWidthPx(),
-      y = y_in_chars * renderer.CellHeightPx();
+      saved.push_back(Saved{chr, color, atlas->LastUsed(slot), tiles.size()});
+
+      tiles.resize(tiles.size() + atlas->TileBytes());
+      atlas->ReadTile(slot, tiles.data() + saved.back().offset);
+    });
+  }
 
-  renderer.RenderCharacter(buffer_, chr, x, y);
-  changes_pending_upload_ = true;
+  std::sort(saved.begin(), saved.end(), [](const Saved &a, const Saved &b) {
+    return a.last_used > b.last_used;
+  });
 
-  auto region = char_map_[chr] = TexRegion<u32>{
-      {x, y}, {x + renderer.CellWidthPx(), y + renderer.CellHeightPx()}};
+  std::vector<GlyphCache::Entry> entries;
 
-  for (uint16_t seg = 0; seg < chr.segment_count; seg++)
-    if (seg != chr.segment_index)
-      MapCharacter(Cell(chr.displayed_code, chr.flags, seg, chr.segment_count));
+  for (const Saved &glyph : saved)
+    entries.push_back(GlyphCache::Entry{glyph.chr, glyph.color,
+                                        tiles.data() + glyph.offset});
 
-  return region;
+  GlyphCache::Write(renderer.CacheKey(), renderer.CellWidthPx(),
+                    renderer.CellHeightPx(), entries);
 }
-}  // namespace bitty
\ No newline at end of file
+}  // namespace bitty
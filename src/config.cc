@@ -1,14 +1,23 @@
 #include "config.hh"
 
 #include <pwd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/poll.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <mutex>
+#include <nlohmann/json.hpp>
+#include <string_view>
+
+#include "util.hh"
 
 namespace bitty {
-ConfigListener::ConfigListener() { Config::Get().Listen(this); }
+void ConfigListener::StartListening() { Config::Get().Listen(this); }
 
 void ConfigListener::StopListening() { Config::Get().StopListening(this); }
 
@@ -49,28 +58,183 @@ std::filesystem::path GetConfigDirectory() {
   return std::filesystem::current_path();
 }
 
+std::filesystem::path GetCacheDirectory() {
+  if (const char *xdg_cache = std::getenv("XDG_CACHE_HOME");
+      xdg_cache && *xdg_cache)
+    return std::filesystem::path(xdg_cache) / "bitty";
+
+  if (const char *home = std::getenv("HOME"))
+    return std::filesystem::path(home) / ".cache" / "bitty";
+
+  return std::filesystem::temp_directory_path() / "bitty";
+}
+
+namespace {
+std::filesystem::path ConfigPath() {
+  return GetConfigDirectory() / "bitty.json";
+}
+
+std::string DefaultShell() {
+  struct passwd *pw = getpwuid(getuid());
+  return pw ? pw->pw_shell : "/bin/sh";
+}
+
+Settings ParseSettings(const nlohmann::json &json) {
+  Settings settings;
+
+  auto get = [&]<typename T>(const char *key, T &value, auto is_type) {
+    if (auto ent = json.find(key); ent != json.end() && is_type(*ent))
+      value = ent->template get<T>();
+  };
+
+  auto is_string = [](const nlohmann::json &ent) { return ent.is_string(); };
+  auto is_number = [](const nlohmann::json &ent) { return ent.is_number(); };
+  auto is_boolean = [](const nlohmann::json &ent) { return ent.is_boolean(); };
+
+  std::string font_family;
+  get("font_family", font_family, is_string);
+  if (!font_family.empty()) settings.font_family = font_family;
+
+  settings.shell = DefaultShell();
+
+  get("font_size", settings.font_size, is_number);
+  get("opacity", settings.opacity, is_number);
+  get("shell", settings.shell, is_string);
+  get("renderer", settings.renderer, is_string);
+  get("cursor_blink_interval", settings.cursor_blink_interval, is_number);
+  get("atlas_memory_limit_mb", settings.atlas_memory_limit_mb, is_number);
+  get("atlas_pbo", settings.atlas_pbo, is_boolean);
+  get("ligatures", settings.ligatures, is_boolean);
+  get("glyph_cache", settings.glyph_cache, is_boolean);
+  get("present_mode", settings.present_mode, is_string);
+
+  settings.opacity = std::clamp(settings.opacity, 0., 1.);
+  settings.cursor_blink_interval = std::max(0, settings.cursor_blink_interval);
+  settings.atlas_memory_limit_mb =
+      std::max(0., settings.atlas_memory_limit_mb);
+
+  get("raster_threads", settings.raster_threads,
+      [](const nlohmann::json &ent) { return ent.is_number_unsigned(); });
+  settings.raster_threads = std::min(settings.raster_threads, 16u);
+
+  return settings;
+}
+}  // namespace
+
+Config::~Config() { StopWatching(); }
+
 bool Config::Reload() {
-  uid_t uid = getuid();
-  struct passwd *pw = getpwuid(uid);
-  default_shell_ = pw ? pw->pw_shell : "/bin/sh";
+  auto path = ConfigPath();
+  nlohmann::json json;
+  bool found = std::filesystem::exists(path);
+
+  if (found) {
+    std::ifstream stream{path};
+
+    try {
+      json = nlohmann::json::parse(stream);
+    } catch (const nlohmann::json::exception &ex) {
+      // Most likely caught halfway through being saved, the next write
+      // triggers another reload
+      LogWarning() << "Failed to parse " << path << ": " << ex.what() << '\n';
+      if (current_.load()) return false;
+    }
+  }
+
+  auto settings = std::make_unique<const Settings>(ParseSettings(json));
 
   std::unique_lock lock{mutex_};
+  current_.store(settings.get(), std::memory_order_release);
+  snapshots_.push_back(std::move(settings));
 
-  auto path = GetConfigDirectory() / "bitty.json";
+  return found;
+}
 
-  if (!std::filesystem::exists(path)) return false;
+void Config::NotifyListeners() {
+  // Getters take no lock, so listeners read the new settings freely, and
+  // none of them can stop listening halfway through
+  std::unique_lock lock{mutex_};
+
+  for (ConfigListener *listener : listeners_) listener->OnConfigReload();
+}
 
-  std::ifstream stream{path};
+void Config::Watch(std::function<void()> on_change) {
+  if (watcher_.joinable()) return;
 
-  try {
-    json_ = nlohmann::json::parse(stream);
-  } catch (const nlohmann::json::exception &ex) {
-    /* TODO */ (void)ex.what();
-    json_ = nlohmann::json{};
+  int inotify_fd = inotify_init1(IN_CLOEXEC);
+
+  // Editors tend to replace the file rather than write to it, so its
+  // directory is watched
+  auto directory = ConfigPath().parent_path();
+
+  if (inotify_fd == -1 ||
+      inotify_add_watch(inotify_fd, directory.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE |
+                            IN_MOVED_FROM) == -1) {
+    LogWarning() << "Failed to watch " << directory
+                 << ", the config is only read at startup\n";
+    if (inotify_fd != -1) close(inotify_fd);
+    return;
   }
 
-  for (auto listener : listeners_) listener->OnConfigReload();
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+
+  watcher_ = std::thread([this, inotify_fd, on_change = std::move(on_change)] {
+    alignas(inotify_event) char buffer[4096];
+
+    // Whether the last read saw bitty.json change
+    auto read_changes = [&] {
+      bool changed = false;
+      ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+
+      for (ssize_t offset = 0; offset < length;) {
+        auto *event = reinterpret_cast<inotify_event *>(buffer + offset);
+
+        if (event->len && std::string_view(event->name) == "bitty.json")
+          changed = true;
+
+        offset += sizeof(inotify_event) + event->len;
+      }
+
+      return changed;
+    };
+
+    for (;;) {
+      struct pollfd fds[2] = {};
+      fds[0].fd = inotify_fd;
+      fds[1].fd = stop_fd_;
+      fds[0].events = POLLIN;
+      fds[1].events = POLLIN;
+
+      if (poll(fds, 2, -1) == -1) {
+        LogError() << "poll(...) call failed?" << std::endl;
+        break;
+      }
+
+      if (fds[1].revents & POLLIN) break;
+
+      if (!(fds[0].revents & POLLIN) || !read_changes()) continue;
+
+      // One save is often several events, they are waited out to reload once
+      while (poll(fds, 1, 50) > 0 && (fds[0].revents & POLLIN))
+        read_changes();
+
+      Reload();
+      if (on_change) on_change();
+    }
+
+    close(inotify_fd);
+  });
+}
+
+void Config::StopWatching() {
+  if (!watcher_.joinable()) return;
+
+  u64 value = 1;
+  write(stop_fd_, &value, sizeof(value));
+  watcher_.join();
 
-  return true;
+  close(stop_fd_);
+  stop_fd_ = -1;
 }
 }  // namespace bitty
@@ -0,0 +1,160 @@
+#include "font_cache.hh"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "config.hh"
+
+namespace bitty {
+namespace {
+constexpr int kVersion = 1;
+
+i64 ModificationTime(const std::filesystem::path &path) {
+  std::error_code error;
+  auto time = std::filesystem::last_write_time(path, error);
+
+  return error ? 0 : time.time_since_epoch().count();
+}
+
+// Latest change to fontconfig's caches or configuration. fc-cache rewrites
+// the cache directories whenever fonts are installed or removed.
+i64 ReadFontconfigStamp() {
+  std::vector<std::filesystem::path> paths = {
+      "/etc/fonts/fonts.conf", "/etc/fonts/conf.d", "/var/cache/fontconfig",
+      "/usr/lib/fontconfig/cache"};
+
+  if (const char *xdg_cache = std::getenv("XDG_CACHE_HOME");
+      xdg_cache && *xdg_cache)
+    paths.push_back(std::filesystem::path(xdg_cache) / "fontconfig");
+  else if (const char *home = std::getenv("HOME"))
+    paths.push_back(std::filesystem::path(home) / ".cache" / "fontconfig");
+
+  paths.push_back(GetConfigDirectory() / "fontconfig");
+
+  i64 stamp = 0;
+
+  for (const auto &path : paths)
+    stamp = std::max(stamp, ModificationTime(path));
+
+  return stamp;
+}
+
+std::string WidthKey(const std::string &file, i64 char_size_266) {
+  return file + '@' + std::to_string(char_size_266);
+}
+}  // namespace
+
+FontCache &FontCache::Get() {
+  static FontCache cache;
+  return cache;
+}
+
+void FontCache::Load() {
+  if (loaded_) return;
+
+  loaded_ = true;
+
+  i64 stamp = ReadFontconfigStamp();
+
+  try {
+    std::ifstream stream{GetCacheDirectory() / "fonts.json"};
+
+    if (stream) json_ = nlohmann::json::parse(stream);
+  } catch (const nlohmann::json::exception &) {
+    json_ = nullptr;
+  }
+
+  if (!json_.is_object() || json_.value("version", 0) != kVersion ||
+      json_.value("fontconfig_stamp", i64(0)) != stamp)
+    json_ = {{"version", kVersion},
+             {"fontconfig_stamp", stamp},
+             {"files", nlohmann::json::object()},
+             {"cell_widths", nlohmann::json::object()}};
+}
+
+void FontCache::Save() {
+  std::filesystem::path dir = GetCacheDirectory();
+  std::error_code error;
+
+  std::filesystem::create_directories(dir, error);
+
+  // Saves of this process are serialized by mutex_, other instances may save
+  // at the same time
+  std::filesystem::path temp_path =
+      dir / ("fonts.json." + std::to_string(getpid()) + ".tmp");
+
+  {
+    std::ofstream stream{temp_path};
+    stream << json_;
+
+    if (!stream) {
+      std::filesystem::remove(temp_path, error);
+      return;
+    }
+  }
+
+  std::filesystem::rename(temp_path, dir / "fonts.json", error);
+}
+
+i64 FontCache::FontconfigStamp() {
+  std::unique_lock lock{mutex_};
+  Load();
+
+  return json_.value("fontconfig_stamp", i64(0));
+}
+
+std::optional<std::string> FontCache::File(const std::string &pattern) {
+  std::unique_lock lock{mutex_};
+  Load();
+
+  auto &files = json_["files"];
+
+  if (auto ent = files.find(pattern); ent != files.end() && ent->is_object()) {
+    std::string file = ent->value("file", "");
+
+    if (!file.empty() && ent->value("mtime", i64(-1)) == ModificationTime(file))
+      return file;
+  }
+
+  return std::nullopt;
+}
+
+void FontCache::SetFile(const std::string &pattern, const std::string &file) {
+  std::unique_lock lock{mutex_};
+  Load();
+
+  json_["files"][pattern] = {{"file", file},
+                             {"mtime", ModificationTime(file)}};
+  Save();
+}
+
+std::optional<i32> FontCache::CellWidth(const std::string &file,
+                                        i64 char_size_266) {
+  std::unique_lock lock{mutex_};
+  Load();
+
+  auto &widths = json_["cell_widths"];
+
+  if (auto ent = widths.find(WidthKey(file, char_size_266));
+      ent != widths.end() && ent->is_object() &&
+      ent->value("mtime", i64(-1)) == ModificationTime(file))
+    return ent->value("width", 0);
+
+  return std::nullopt;
+}
+
+void FontCache::SetCellWidth(const std::string &file, i64 char_size_266,
+                             i32 width) {
+  std::unique_lock lock{mutex_};
+  Load();
+
+  json_["cell_widths"][WidthKey(file, char_size_266)] = {
+      {"width", width}, {"mtime", ModificationTime(file)}};
+  Save();
+}
+}  // namespace bitty
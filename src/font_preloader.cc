@@ -0,0 +1,69 @@
+#include "font_preloader.hh"
+
+#include <chrono>
+#include <format>
+#include <utility>
+
+#include "box_drawing.hh"
+#include "font_renderer.hh"
+#include "util.hh"
+
+namespace bitty {
+FontPreloader::~FontPreloader() {
+  if (thread_.joinable()) thread_.join();
+}
+
+void FontPreloader::Start(const Settings &settings, double zoom,
+                          std::vector<Cell> cells,
+                          std::function<void()> on_ready) {
+  // Finished already, or it would still be busy
+  if (thread_.joinable()) thread_.join();
+
+  busy_ = true;
+
+  thread_ = std::thread([this, &settings, zoom, cells = std::move(cells),
+                         on_ready = std::move(on_ready)] {
+    auto start = std::chrono::steady_clock::now();
+
+    FontRenderer renderer(settings, zoom);
+    Prepared prepared{&settings, zoom, {}};
+
+    for (Cell chr : cells) {
+      // Charset draws those itself at no cost
+      if (IsBoxDrawing(chr.displayed_code) &&
+          !(chr.flags & (CellFlags::kShaped | CellFlags::kGrapheme)))
+        continue;
+
+      prepared.glyphs.push_back({chr, renderer.RenderGlyph(chr)});
+    }
+
+    LogInfo() << std::format(
+        "Prepared {} at zoom {:.2f} in {:.1f} ms, {} glyphs\n",
+        settings.font_family.value_or("monospace"), zoom,
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start)
+            .count(),
+        prepared.glyphs.size());
+
+    {
+      std::unique_lock lock{mutex_};
+      prepared_ = std::move(prepared);
+    }
+
+    if (on_ready) on_ready();
+  });
+}
+
+std::optional<FontPreloader::Prepared> FontPreloader::Take() {
+  std::optional<Prepared> prepared;
+
+  {
+    std::unique_lock lock{mutex_};
+    std::swap(prepared, prepared_);
+  }
+
+  if (prepared) busy_ = false;
+
+  return prepared;
+}
+}  // namespace bitty
@@ -4,109 +4,404 @@
 #include <freetype/freetype.h>
 #include <freetype/ftimage.h>
 #include <freetype/fttypes.h>
+#include <harfbuzz/hb-ft.h>
+#include <harfbuzz/hb-ot.h>
 
+#include <algorithm>
+#include <boost/container_hash/hash.hpp>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <format>
 #include <mutex>
 #include <stdexcept>
 
 #include "cell_buffer.hh"
-#include "charset.hh"
+#include "font_cache.hh"
+#include "grapheme.hh"
+#include "shaper.hh"
 #include "util.hh"
 
 #include FT_LCD_FILTER_H
 
 namespace bitty {
-FontRenderer::FontRenderer() {
+FontRenderer::FontRenderer()
+    : FontRenderer(Config::Get().Snapshot(), 1.0, true) {}
+
+FontRenderer::FontRenderer(const Settings &settings, double zoom)
+    : FontRenderer(settings, zoom, false) {}
+
+FontRenderer::FontRenderer(const Settings &settings, double zoom,
+                           bool follows_font)
+    : settings_(&settings), zoom_(zoom), follows_font_(follows_font) {
   FT_Error error{FT_Init_FreeType(&library_)};
 
   if (error) throw std::runtime_error("Failed to initialize FreeType");
 
-  OnConfigReload();
+  std::unique_lock lock{mutex_};
+
+  if (!FollowFont()) LoadFaces();
 }
 
-void FontRenderer::OnConfigReload() {
-  std::unique_lock lock{mutex_};
+FontRenderer::~FontRenderer() {
+  ReleaseHbFonts();
+  if (hb_buffer_) hb_buffer_destroy(hb_buffer_);
+
+  for (FT_Face face : {face_normal_, face_bold_})
+    if (face) FT_Done_Face(face);
+
+  ReleaseFallbacks();
+  FT_Done_FreeType(library_);
+}
+
+namespace {
+// Loads fontconfig's configuration and sorts every font on the system, so
+// it is slow with large font collections. Results go into FontCache.
+std::string MatchFontFile(const std::string &family, bool bold) {
+  FcConfig* fc_config = FcInitLoadConfigAndFonts();
+
+  FcPattern* pat = FcNameParse((const FcChar8*)family.c_str());
+
+  FcPatternAddInteger(pat, FC_WEIGHT, bold ? FC_WEIGHT_BOLD : FC_WEIGHT_MEDIUM);
+
+  FcConfigSubstitute(fc_config, pat, FcMatchPattern);
+  FcDefaultSubstitute(pat);
+
+  FcResult res;
+  FcPattern* font;
+
+  FcFontSet* fs = FcFontSetCreate();
+  FcObjectSet* os = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_FILE, (char*)0);
+
+  FcFontSet* font_patterns;
+  font_patterns = FcFontSort(fc_config, pat, FcTrue, 0, &res);
+
+  if (!font_patterns || font_patterns->nfont == 0)
+    throw std::runtime_error{
+        "Fontconfig could not find any fonts on the system\n"};
+
+  FcPattern* font_pattern;
+
+  if ((font_pattern =
+           FcFontRenderPrepare(fc_config, pat, font_patterns->fonts[0])))
+    FcFontSetAdd(fs, font_pattern);
+  else
+    throw std::runtime_error{"Could not prepare matched font for loading.\n"};
+
+  const char* font_file = nullptr;
+
+  FcValue v;
+
+  if (fs && fs->nfont > 0) {
+    font = FcPatternFilter(fs->fonts[0], os);
+
+    FcPatternGet(font, FC_FILE, 0, &v);
+    font_file = (char*)v.u.f;
+  } else
+    throw std::runtime_error("Could not obtain fs\n");
+
+  ScopeGuard sg([&] {
+    FcFontSetSortDestroy(font_patterns);
+    FcPatternDestroy(pat);
+    FcFontSetDestroy(fs);
+    FcPatternDestroy(font);
+    FcConfigDestroy(fc_config);
+  });
+
+  LogInfo() << "Found " << font_file << " for " << family << '\n';
+
+  return font_file;
+}
+
+double MsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+}  // namespace
+
+std::string FontRenderer::FontPattern(bool bold) const {
+  return font_family_ + (bold ? ":bold" : ":medium");
+}
+
+std::string FontRenderer::ResolveFontFile(bool bold) {
+  if (auto file = FontCache::Get().File(FontPattern(bold))) return *file;
+
+  std::string file = MatchFontFile(font_family_, bold);
+  FontCache::Get().SetFile(FontPattern(bold), file);
+
+  return file;
+}
+
+FT_Face FontRenderer::LoadFace(const std::string& file, int index) {
+  FT_Face face;
+
+  if (FT_New_Face(library_, file.c_str(), index, &face)) return nullptr;
+
+  FT_Error error;
+
+  // Color emoji fonts only come in fixed sizes; RenderGlyph() scales them
+  // down to the cell
+  if (!FT_IS_SCALABLE(face) && face->num_fixed_sizes > 0) {
+    int best = 0;
+
+    for (int i = 1; i < face->num_fixed_sizes; i++)
+      if (std::abs(face->available_sizes[i].y_ppem - char_size_266_) <
+          std::abs(face->available_sizes[best].y_ppem - char_size_266_))
+        best = i;
+
+    error = FT_Select_Size(face, best);
+  } else
+    error = FT_Set_Char_Size(face, 0, char_size_266_, 0, 0);
+
+  if (error) {
+    FT_Done_Face(face);
+    return nullptr;
+  }
+
+  return face;
+}
+
+void FontRenderer::ResolveFallbacks() {
+  fallbacks_resolved_ = true;
 
-  const auto& conf = Config::Get();
+  auto start = std::chrono::steady_clock::now();
 
-  std::string font_family = conf.FontFamily().value_or("monospace");
+  FcConfig* fc_config = FcInitLoadConfigAndFonts();
+  FcPattern* pat = FcNameParse((const FcChar8*)font_family_.c_str());
 
-  double font_pt = conf.FontSize() * conf.CalcPixelsPerPt() * 1.25;
+  FcConfigSubstitute(fc_config, pat, FcMatchPattern);
+  FcDefaultSubstitute(pat);
 
-  for (const auto& [is_bold, face] :
-       {std::tuple{false, &face_normal_}, std::tuple{true, &face_bold_}}) {
-    FcConfig* fc_config = FcInitLoadConfigAndFonts();
+  FcResult res;
 
-    auto ff = font_family;
+  // Trimmed, so only fonts covering something the ones before them do not
+  // are part of the chain
+  FcFontSet* font_patterns = FcFontSort(fc_config, pat, FcTrue, 0, &res);
 
-    FcPattern* pat = FcNameParse((const FcChar8*)ff.c_str());
+  ScopeGuard sg([&] {
+    if (font_patterns) FcFontSetSortDestroy(font_patterns);
+    FcPatternDestroy(pat);
+    FcConfigDestroy(fc_config);
+  });
 
-    FcPatternAddInteger(pat, FC_WEIGHT,
-                        is_bold ? FC_WEIGHT_BOLD : FC_WEIGHT_MEDIUM);
+  if (!font_patterns) return;
 
-    FcConfigSubstitute(fc_config, pat, FcMatchPattern);
-    FcDefaultSubstitute(pat);
+  for (int i = 0; i < font_patterns->nfont && fallbacks_.size() < kMaxFallbacks;
+       i++) {
+    FcPattern* font = font_patterns->fonts[i];
+    FcChar8* file;
+    FcCharSet* charset;
+    int index = 0;
 
-    FcResult res;
-    FcPattern* font;
+    if (FcPatternGetString(font, FC_FILE, 0, &file) != FcResultMatch ||
+        FcPatternGetCharSet(font, FC_CHARSET, 0, &charset) != FcResultMatch)
+      continue;
 
-    FcFontSet* fs = FcFontSetCreate();
-    FcObjectSet* os = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_FILE, (char*)0);
+    FcPatternGetInteger(font, FC_INDEX, 0, &index);
 
-    FcFontSet* font_patterns;
-    font_patterns = FcFontSort(fc_config, pat, FcTrue, 0, &res);
+    if ((const char*)file == file_normal_ && index == 0) continue;
 
-    if (!font_patterns || font_patterns->nfont == 0)
-      throw std::runtime_error{
-          "Fontconfig could not find any fonts on the system\n"};
+    // The set goes away with fc_config, so the charset is copied out of it
+    FcCharSet* copy = FcCharSetCreate();
+    FcCharSetMerge(copy, charset, nullptr);
 
-    FcPattern* font_pattern;
+    fallbacks_.push_back(Fallback{(const char*)file, index, copy});
+  }
+
+  LogInfo() << std::format("Resolved {} fallback fonts in {:.1f} ms\n",
+                           fallbacks_.size(), MsSince(start));
+}
+
+void FontRenderer::ReleaseFallbacks() {
+  for (Fallback& fallback : fallbacks_) {
+    if (fallback.face) FT_Done_Face(fallback.face);
+    FcCharSetDestroy(fallback.charset);
+  }
+
+  fallbacks_.clear();
+  fallbacks_resolved_ = false;
+
+  for (auto& page : coverage_) page.reset();
+}
+
+u8 FontRenderer::FaceIndexOf(char32_t codepoint) {
+  if (codepoint >= kCodepointLimit) return kNoFace;
+
+  std::unique_ptr<CoveragePage>& page = coverage_[codepoint >> 8];
+
+  // Only the regular face is asked here, it is loaded anyway
+  if (!page) {
+    page = std::make_unique<CoveragePage>();
+
+    char32_t first = codepoint & ~char32_t(0xFF);
 
-    if ((font_pattern =
-             FcFontRenderPrepare(fc_config, pat, font_patterns->fonts[0])))
-      FcFontSetAdd(fs, font_pattern);
-    else
-      throw std::runtime_error{"Could not prepare matched font for loading.\n"};
+    for (u32 i = 0; i < 256; i++)
+      (*page)[i] = FT_Get_Char_Index(face_normal_, first + i) ? kPrimaryFace
+                                                              : kUnresolved;
+  }
+
+  u8& face = (*page)[codepoint & 0xFF];
+
+  if (face == kUnresolved) {
+    if (!fallbacks_resolved_) ResolveFallbacks();
 
-    const char* font_file = nullptr;
+    face = kNoFace;
+
+    for (size_t i = 0; i < fallbacks_.size(); i++)
+      if (FcCharSetHasChar(fallbacks_[i].charset, codepoint)) {
+        face = i + 1;
+        break;
+      }
+  }
 
-    FcValue v;
+  return face;
+}
 
-    if (fs && fs->nfont > 0) {
-      font = FcPatternFilter(fs->fonts[0], os);
+std::pair<FT_Face, FT_UInt> FontRenderer::FindGlyph(char32_t codepoint,
+                                                     bool bold) {
+  if (bold) {
+    FT_Face face = BoldFace();
 
-      FcPatternGet(font, FC_FILE, 0, &v);
-      font_file = (char*)v.u.f;
-    } else
-      throw std::runtime_error("Could not obtain fs\n");
+    if (FT_UInt glyph = FT_Get_Char_Index(face, codepoint))
+      return {face, glyph};
+  }
 
-    ScopeGuard sg([&] {
-      FcFontSetSortDestroy(font_patterns);
-      FcPatternDestroy(font_pattern);
-      FcPatternDestroy(pat);
-      FcFontSetDestroy(fs);
-      FcPatternDestroy(font);
-      FcConfigDestroy(fc_config);
-    });
+  u8 index = FaceIndexOf(codepoint);
 
-    LogInfo() << "Found " << font_file << " for " << ff << '\n';
+  if (index == kPrimaryFace)
+    return {face_normal_, FT_Get_Char_Index(face_normal_, codepoint)};
 
-    FT_Error error{FT_New_Face(library_, font_file, 0, face)};
+  if (index != kNoFace) {
+    Fallback& fallback = fallbacks_[index - 1];
 
-    if (error) throw std::runtime_error("Error initializing face");
+    if (!fallback.face && !fallback.failed) {
+      fallback.face = LoadFace(fallback.file, fallback.index);
+      fallback.failed = !fallback.face;
 
-    if (is_bold && !((*face)->style_flags & FT_STYLE_FLAG_BOLD))
-      LogWarning() << "Failed to find bold typeface for " << ff << '\n';
+      if (fallback.failed)
+        LogWarning() << "Failed to load fallback font " << fallback.file
+                     << '\n';
+    }
 
-    if ((error = FT_Set_Char_Size(*face, 0, font_pt * 64.0, 0, 0)))
-      throw std::runtime_error("Error setting character size");
+    if (fallback.face)
+      if (FT_UInt glyph = FT_Get_Char_Index(fallback.face, codepoint))
+        return {fallback.face, glyph};
   }
 
+  // The regular face's .notdef glyph
+  return {face_normal_, 0};
+}
+
+FT_Face FontRenderer::BoldFace() {
+  if (face_bold_ || bold_failed_) return face_bold_ ? face_bold_ : face_normal_;
+
+  auto start = std::chrono::steady_clock::now();
+
+  file_bold_ = ResolveFontFile(true);
+  face_bold_ = LoadFace(file_bold_);
+
+  if (!face_bold_) {
+    LogWarning() << "Failed to load " << file_bold_ << ", using "
+                 << file_normal_ << " for bold text\n";
+    bold_failed_ = true;
+    return face_normal_;
+  }
+
+  if (!(face_bold_->style_flags & FT_STYLE_FLAG_BOLD))
+    LogWarning() << "Failed to find bold typeface for " << font_family_
+                 << '\n';
+
+  LogInfo() << std::format("Loaded the bold face in {:.1f} ms\n",
+                           MsSince(start));
+
+  return face_bold_;
+}
+
+bool FontRenderer::FollowFont() {
+  if (!follows_font_ || generation_ == font_generation_) return false;
+
+  {
+    std::unique_lock lock{font_mutex_};
+
+    if (!font_settings_) font_settings_ = settings_;
+
+    settings_ = font_settings_;
+    zoom_ = font_zoom_;
+    generation_ = font_generation_;
+  }
+
+  LoadFaces();
+  return true;
+}
+
+void FontRenderer::SetFont(const Settings &settings, double zoom) {
+  {
+    std::unique_lock lock{font_mutex_};
+
+    font_settings_ = &settings;
+    font_zoom_ = zoom;
+    font_generation_++;
+  }
+
+  FontRenderer &renderer = Get();
+  std::unique_lock lock{renderer.mutex_};
+
+  renderer.FollowFont();
+}
+
+bool FontRenderer::IsFont(const Settings &settings, double zoom) {
+  std::unique_lock lock{font_mutex_};
+
+  const Settings &font =
+      font_settings_ ? *font_settings_ : Config::Get().Snapshot();
+
+  return font.font_family == settings.font_family &&
+         font.font_size == settings.font_size && font_zoom_ == zoom;
+}
+
+void FontRenderer::LoadFaces() {
+  auto start = std::chrono::steady_clock::now();
+
+  font_family_ = settings_->font_family.value_or("monospace");
+
+  double font_pt =
+      settings_->font_size * zoom_ * Config::Get().CalcPixelsPerPt() * 1.25;
+
+  char_size_266_ = font_pt * 64.0;
+
+  ReleaseHbFonts();
+
+  // Bold text is rarer than one would think, so its face waits for it
+  for (FT_Face* face : {&face_normal_, &face_bold_}) {
+    if (*face) FT_Done_Face(*face);
+    *face = nullptr;
+  }
+
+  file_bold_.clear();
+  bold_failed_ = false;
+
+  ReleaseFallbacks();
+
+  file_normal_ = ResolveFontFile(false);
+
+  double resolve_ms = MsSince(start);
+  auto load_start = std::chrono::steady_clock::now();
+
+  if (!(face_normal_ = LoadFace(file_normal_)))
+    throw std::runtime_error("Error initializing face");
+
+  double load_ms = MsSince(load_start);
+  auto measure_start = std::chrono::steady_clock::now();
+
   cell_width_px_ = 0;
   baseline_y_ = CeilFrom266(face_normal_->size->metrics.ascender);
   cell_height_px_ = CeilFrom266(face_normal_->size->metrics.height);
 
-  i32 cell_width_266 = 0;
+  std::optional<i32> cached_width =
+      FontCache::Get().CellWidth(file_normal_, char_size_266_);
+  i32 cell_width_266 = cached_width.value_or(0);
 
   auto check_glyph = [&](char32_t codepoint,
                          bool adjust_width = false) mutable {
@@ -123,56 +418,283 @@ void FontRenderer::OnConfigReload() {
     }
   };
 
-  for (uint32_t i = 0x21; i < 0x80; i++) check_glyph(i, true);
+  if (!cached_width) {
+    for (uint32_t i = 0x21; i < 0x80; i++) check_glyph(i, true);
+
+    FontCache::Get().SetCellWidth(file_normal_, char_size_266_,
+                                  cell_width_266);
+  }
 
   cell_width_px_ = CeilFrom266(cell_width_266);
+
+  LogInfo() << std::format(
+      "Font ready in {:.1f} ms: resolve {:.1f} ms, load {:.1f} ms, measure "
+      "{:.1f} ms{}\n",
+      MsSince(start), resolve_ms, load_ms, MsSince(measure_start),
+      cached_width ? " (cached)" : "");
 }
 
-bool FontRenderer::RenderCharacter(CharsetBuffer& buf, Cell chr, size_t x,
-                                   size_t y) {
-  FT_Face face;
+namespace {
+constexpr FT_Int32 kGlyphLoadFlags = FT_LOAD_TARGET_LIGHT | FT_LOAD_COLOR;
 
-  bool bold = chr.flags & CellFlags::kBold;
+// Box filter, for color bitmaps that only come in fixed sizes far larger
+// than a cell
+GlyphBitmap ScaleColorBitmap(const GlyphBitmap &src, double scale) {
+  GlyphBitmap dst;
+  dst.width = std::max(1, i32(std::lround(src.width * scale)));
+  dst.rows = std::max(1, i32(std::lround(src.rows * scale)));
+  dst.left = std::lround(src.left * scale);
+  dst.top = std::lround(src.top * scale);
+  dst.color = true;
+  dst.pixels.resize(dst.width * dst.rows * 4);
 
-  if (bold)
-    face = face_bold_;
-  else
-    face = face_normal_;
+  for (u32 y = 0; y < dst.rows; y++) {
+    u32 y0 = y * src.rows / dst.rows;
+    u32 y1 = std::max(y0 + 1, (y + 1) * src.rows / dst.rows);
+
+    for (u32 x = 0; x < dst.width; x++) {
+      u32 x0 = x * src.width / dst.width;
+      u32 x1 = std::max(x0 + 1, (x + 1) * src.width / dst.width);
+
+      u32 sum[4] = {};
+
+      for (u32 sy = y0; sy < y1; sy++)
+        for (u32 sx = x0; sx < x1; sx++)
+          for (u32 c = 0; c < 4; c++)
+            sum[c] += src.pixels[(sy * src.width + sx) * 4 + c];
+
+      u32 count = (y1 - y0) * (x1 - x0);
 
+      for (u32 c = 0; c < 4; c++)
+        dst.pixels[(y * dst.width + x) * 4 + c] = sum[c] / count;
+    }
+  }
+
+  return dst;
+}
+}  // namespace
+
+hb_font_t* FontRenderer::HbFont(bool bold) {
+  hb_font_t*& font = bold ? hb_bold_ : hb_normal_;
+
+  if (!font)
+    font = hb_ft_font_create_referenced(bold ? BoldFace() : face_normal_);
+
+  return font;
+}
+
+void FontRenderer::ReleaseHbFonts() {
+  for (hb_font_t** font : {&hb_normal_, &hb_bold_}) {
+    if (*font) hb_font_destroy(*font);
+    *font = nullptr;
+  }
+}
+
+bool FontRenderer::HasSubstitutions(bool bold) {
   std::unique_lock lock{mutex_};
 
-  FT_UInt glyph_index{FT_Get_Char_Index(face, chr.displayed_code)};
+  return hb_ot_layout_has_substitution(hb_font_get_face(HbFont(bold)));
+}
+
+u32 FontRenderer::NominalGlyph(char32_t codepoint, bool bold) {
+  std::unique_lock lock{mutex_};
+
+  return FT_Get_Char_Index(bold ? BoldFace() : face_normal_, codepoint);
+}
+
+void FontRenderer::Shape(const std::u32string& text, bool bold,
+                         std::vector<ShapedGlyph>& glyphs) {
+  std::unique_lock lock{mutex_};
+
+  ShapeWith(HbFont(bold), text, glyphs);
+}
+
+void FontRenderer::ShapeWith(hb_font_t* font, const std::u32string& text,
+                             std::vector<ShapedGlyph>& glyphs) {
+  if (!hb_buffer_) hb_buffer_ = hb_buffer_create();
+
+  hb_buffer_clear_contents(hb_buffer_);
+  hb_buffer_add_utf32(hb_buffer_, (const u32*)text.data(), text.size(), 0,
+                      text.size());
+  hb_buffer_guess_segment_properties(hb_buffer_);
 
-  FT_Error error{FT_Load_Glyph(face, glyph_index, FT_LOAD_TARGET_LIGHT)};
+  hb_shape(font, hb_buffer_, nullptr, 0);
 
-  if (error) return false;
+  unsigned count;
+  hb_glyph_info_t* infos = hb_buffer_get_glyph_infos(hb_buffer_, &count);
+  hb_glyph_position_t* positions =
+      hb_buffer_get_glyph_positions(hb_buffer_, nullptr);
+
+  glyphs.clear();
+
+  for (unsigned i = 0; i < count; i++)
+    glyphs.push_back(ShapedGlyph{infos[i].codepoint, infos[i].cluster,
+                                 positions[i].x_advance, positions[i].x_offset,
+                                 positions[i].y_offset});
+}
+
+std::optional<GlyphBitmap> FontRenderer::RenderCluster(
+    FT_Face face, const GlyphCluster& cluster) {
+  GlyphBitmap bitmap;
+  bitmap.width = cluster.cells * cell_width_px_;
+  bitmap.rows = cell_height_px_;
+  bitmap.left = 0;
+  bitmap.top = baseline_y_;
+  bitmap.pixels.resize(bitmap.width * bitmap.rows);
+
+  // Coverage of overlapping glyphs is combined with max, as FreeType's is
+  for (const GlyphCluster::Glyph& glyph : cluster.glyphs) {
+    if (FT_Load_Glyph(face, glyph.glyph, FT_LOAD_TARGET_LIGHT) ||
+        FT_Render_Glyph(face->glyph, FT_RENDER_MODE_LIGHT))
+      continue;
+
+    FT_GlyphSlot slot = face->glyph;
+    FT_Bitmap* bmp = &slot->bitmap;
+
+    if (bmp->pixel_mode != FT_PIXEL_MODE_GRAY) continue;
+
+    i32 x0 = (glyph.x + 32) / 64 + slot->bitmap_left;
+    i32 y0 = baseline_y_ - slot->bitmap_top - (glyph.y + 32) / 64;
+
+    for (u32 y = 0; y < bmp->rows; y++) {
+      i32 dst_y = y0 + i32(y);
+      if (dst_y < 0 || dst_y >= i32(bitmap.rows)) continue;
+
+      for (u32 x = 0; x < bmp->width; x++) {
+        i32 dst_x = x0 + i32(x);
+        if (dst_x < 0 || dst_x >= i32(bitmap.width)) continue;
+
+        u8& dst = bitmap.pixels[dst_y * bitmap.width + dst_x];
+        dst = std::max(dst, bmp->buffer[i64(y) * bmp->pitch + x]);
+      }
+    }
+  }
+
+  return bitmap;
+}
+
+std::optional<GlyphBitmap> FontRenderer::RenderGrapheme(Cell chr) {
+  std::optional<std::u32string> text = FindGrapheme(chr.displayed_code);
+  if (!text) return std::nullopt;
+
+  // The face of the first codepoint draws the whole cluster
+  FT_Face face = FindGlyph((*text)[0], chr.flags & CellFlags::kBold).first;
+
+  hb_font_t* font = hb_ft_font_create_referenced(face);
+  ShapeWith(font, *text, grapheme_glyphs_);
+  hb_font_destroy(font);
+
+  if (grapheme_glyphs_.empty()) return std::nullopt;
+
+  // Color glyphs do not compose, so a sequence the font has no single
+  // glyph for shows its first one
+  if (grapheme_glyphs_.size() == 1 || FT_HAS_COLOR(face))
+    return RenderGlyphIndex(face, grapheme_glyphs_[0].glyph,
+                            chr.segment_count);
+
+  GlyphCluster cluster{.bold = false, .cells = chr.segment_count, .glyphs = {}};
+  i32 pen = 0;
+
+  for (const ShapedGlyph& glyph : grapheme_glyphs_) {
+    cluster.glyphs.push_back(
+        GlyphCluster::Glyph{glyph.glyph, pen + glyph.x_offset, glyph.y_offset});
+    pen += glyph.x_advance;
+  }
+
+  return RenderCluster(face, cluster);
+}
+
+std::optional<GlyphBitmap> FontRenderer::RenderGlyph(Cell chr) {
+  std::unique_lock lock{mutex_};
+
+  FollowFont();
+
+  if (chr.flags & CellFlags::kShaped) {
+    std::optional<GlyphCluster> cluster = FindGlyphCluster(chr.displayed_code);
+    return cluster ? RenderCluster(cluster->bold ? BoldFace() : face_normal_,
+                                   *cluster)
+                   : std::nullopt;
+  }
+
+  if (chr.flags & CellFlags::kGrapheme) return RenderGrapheme(chr);
+
+  auto [face, glyph_index] =
+      FindGlyph(chr.displayed_code, chr.flags & CellFlags::kBold);
+
+  return RenderGlyphIndex(face, glyph_index, chr.segment_count);
+}
+
+std::optional<GlyphBitmap> FontRenderer::RenderGlyphIndex(FT_Face face,
+                                                          FT_UInt glyph_index,
+                                                          u32 cells) {
+  FT_Error error{FT_Load_Glyph(face, glyph_index, kGlyphLoadFlags)};
+
+  if (error) return std::nullopt;
 
   FT_GlyphSlot slot{face->glyph};
 
-  if ((error = FT_Render_Glyph(slot, FT_RENDER_MODE_LIGHT))) return false;
+  if ((error = FT_Render_Glyph(slot, FT_RENDER_MODE_LIGHT)))
+    return std::nullopt;
+
+  FT_Bitmap *bmp = &slot->bitmap;
+
+  GlyphBitmap glyph;
+  glyph.width = bmp->width;
+  glyph.rows = bmp->rows;
+  glyph.left = slot->bitmap_left;
+  glyph.top = slot->bitmap_top;
+  glyph.color = bmp->pixel_mode == FT_PIXEL_MODE_BGRA;
+
+  u32 row_bytes = glyph.width * (glyph.color ? 4 : 1);
+  glyph.pixels.resize(row_bytes * glyph.rows);
+
+  for (u32 y = 0; y < glyph.rows; y++)
+    std::memcpy(glyph.pixels.data() + y * row_bytes,
+                bmp->buffer + i64(y) * bmp->pitch, row_bytes);
 
-  return buf.Render(slot, x, y, chr);
+  // Fit color glyphs into the cells they span
+  if (glyph.color && glyph.rows && glyph.width) {
+    cells = std::max<u32>(1, cells);
+    double scale = std::min(double(cell_height_px_) / glyph.rows,
+                            double(cell_width_px_ * cells) / glyph.width);
+
+    if (scale < 1) glyph = ScaleColorBitmap(glyph, scale);
+  }
+
+  return glyph;
 }
 
-u32 FontRenderer::GetCodePointWidthInCells(char32_t codepoint) {
-  if (auto it = width_in_cells_cache_.find(codepoint);
-      it != width_in_cells_cache_.end())
-    return it->second;
+u64 FontRenderer::CacheKey() {
+  std::unique_lock lock{mutex_};
 
-  FT_UInt glyph_index{FT_Get_Char_Index(face_normal_, codepoint)};
+  size_t key = 0;
 
-  FT_Load_Glyph(face_normal_, glyph_index, FT_LOAD_TARGET_LIGHT);
+  // The bold face may not be loaded yet, but has most likely been resolved
+  // by an earlier run
+  std::string file_bold =
+      file_bold_.empty()
+          ? FontCache::Get().File(FontPattern(true)).value_or("")
+          : file_bold_;
 
-  u32 pixels = std::abs(CeilFrom266(face_normal_->glyph->metrics.width)) +
-               std::abs(CeilFrom266(face_normal_->glyph->metrics.horiBearingX));
+  for (const std::string &file : {file_normal_, file_bold}) {
+    std::error_code error;
 
-  u32 w = CellWidthPx();
+    boost::hash_combine(key, file);
+    boost::hash_combine(key, std::filesystem::file_size(file, error));
+    boost::hash_combine(key, std::filesystem::last_write_time(file, error)
+                                 .time_since_epoch()
+                                 .count());
+  }
 
-  if (width_in_cells_cache_.size() >= kMaxWidthInCellsCacheSize)
-    width_in_cells_cache_.erase(width_in_cells_cache_.begin());
+  // Fallback fonts come and go with fontconfig's caches
+  boost::hash_combine(key, FontCache::Get().FontconfigStamp());
+  boost::hash_combine(key, char_size_266_);
+  boost::hash_combine(key, kGlyphLoadFlags);
+  boost::hash_combine(key, cell_width_px_);
+  boost::hash_combine(key, cell_height_px_);
+  boost::hash_combine(key, baseline_y_);
 
-  return width_in_cells_cache_[codepoint] =
-             std::max(0, i32(pixels + w - 3)) / w;
+  return key;
 }
 
 FontRenderer& FontRenderer::Get() {
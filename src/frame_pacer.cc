@@ -0,0 +1,51 @@
+#include "frame_pacer.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bitty {
+PresentMode ParsePresentMode(std::string_view name) {
+  if (name == "vsync") return PresentMode::kVsync;
+  if (name == "low_latency") return PresentMode::kLowLatency;
+
+  if (name != "immediate")
+    LogWarning() << "Unknown present_mode \"" << name
+                 << "\", using immediate\n";
+
+  return PresentMode::kImmediate;
+}
+
+FramePacer::FramePacer(PresentMode mode, double refresh_rate)
+    : mode_(mode), period_(1. / (refresh_rate > 0 ? refresh_rate : 60)) {}
+
+double FramePacer::RenderStartTime(double now) const {
+  if (mode_ != PresentMode::kLowLatency || last_vblank_ < 0) return now;
+
+  double budget =
+      *std::max_element(render_times_.begin(), render_times_.end()) +
+      kSafetyMargin;
+
+  // Start of the first vblank that can still be reached from now
+  double vblanks = std::ceil((now + budget - last_vblank_) / period_);
+  double start = last_vblank_ + vblanks * period_ - budget;
+
+  return std::max(now, start);
+}
+
+void FramePacer::FramePresented(double render_time, double presented_at) {
+  render_times_[render_head_] = render_time;
+  render_head_ = (render_head_ + 1) % kRenderSamples;
+
+  if (last_vblank_ >= 0) {
+    double elapsed = presented_at - last_vblank_;
+    double vblanks = std::round(elapsed / period_);
+
+    // Only presents that line up with the current estimate refine it; a
+    // stalled frame or a new monitor would drag it off otherwise.
+    if (vblanks >= 1 && std::abs(elapsed - vblanks * period_) < period_ / 4)
+      period_ += (elapsed / vblanks - period_) / 16;
+  }
+
+  last_vblank_ = presented_at;
+}
+}  // namespace bitty
@@ -0,0 +1,84 @@
+#include "frame_stats.hh"
+
+#include <glad/gl.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace bitty {
+FrameStats &FrameStats::Get() {
+  static FrameStats stats;
+  return stats;
+}
+
+void FrameStats::RecordLatency(float ms) {
+  latencies_ms_[latency_head_] = ms;
+  latency_head_ = (latency_head_ + 1) % kLatencySamples;
+  latency_count_ = std::min(latency_count_ + 1, kLatencySamples);
+}
+
+float FrameStats::LatencyPercentileMs(float p) const {
+  if (!latency_count_) return 0;
+
+  // Order does not matter once the ring is full, so the first latency_count_
+  // entries are always the samples.
+  std::vector<float> sorted(latencies_ms_.begin(),
+                            latencies_ms_.begin() + latency_count_);
+
+  size_t index = std::min<size_t>(p * latency_count_, latency_count_ - 1);
+  std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+
+  return sorted[index];
+}
+
+void FrameStats::BeginGpuTimer() {
+  if (!enabled_) return;
+
+  if (!queries_[0]) glGenQueries(kQueryCount, queries_.data());
+
+  GLuint query = queries_[query_index_];
+
+  if (query_pending_[query_index_]) {
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+    // Skip timing this frame rather than stall on a query still in flight
+    if (!available) return;
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+    gpu_ns_ = elapsed;
+    query_pending_[query_index_] = false;
+  }
+
+  glBeginQuery(GL_TIME_ELAPSED, query);
+  timing_ = true;
+}
+
+void FrameStats::EndGpuTimer() {
+  if (!timing_) return;
+
+  glEndQuery(GL_TIME_ELAPSED);
+
+  query_pending_[query_index_] = true;
+  query_index_ = (query_index_ + 1) % kQueryCount;
+  timing_ = false;
+}
+
+void FrameStats::EndFrame() {
+  auto now = std::chrono::steady_clock::now();
+
+  if (last_frame_end_.time_since_epoch().count()) {
+    intervals_ms_[history_head_] =
+        std::chrono::duration<float, std::milli>(now - last_frame_end_)
+            .count();
+    history_head_ = (history_head_ + 1) % kHistorySize;
+  }
+
+  last_frame_end_ = now;
+
+  last_ = current_;
+  current_ = {};
+}
+}  // namespace bitty
@@ -4,11 +4,13 @@
 
 #include <fstream>
 #include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
 #include <sstream>
 
 #include "util.hh"
 
 namespace bitty {
+GLuint GLProgram::current_program_ = 0;
 
 GLProgram GLProgram::FromFiles(const std::string &vertex_file,
                                const std::string &fragment_file) {
@@ -79,59 +81,114 @@ void GLProgram::Reset(const std::string &vertex, const std::string &fragment) {
   glLinkProgram(program_);
   
   PrintProgramLog(program_);
+
+  ReflectUniforms();
 }
 
-void GLProgram::Use() { glUseProgram(program_); }
+void GLProgram::ReflectUniforms() {
+  uniforms_.clear();
+
+  GLint count = 0, max_length = 0;
+  glGetProgramiv(program_, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(program_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+  std::string name(max_length, '\0');
+
+  for (GLint i = 0; i < count; i++) {
+    GLsizei length = 0;
+    GLint size;
+    GLenum type;
+
+    glGetActiveUniform(program_, i, max_length, &length, &size, &type,
+                       name.data());
+
+    std::string uniform_name = name.substr(0, length);
+
+    // Arrays are reported by their first element
+    if (uniform_name.ends_with("[0]")) uniform_name.resize(length - 3);
+
+    // Members of uniform blocks have no location of their own
+    if (GLint location = glGetUniformLocation(program_, uniform_name.c_str());
+        location != -1)
+      uniforms_.emplace(std::move(uniform_name), Uniform{location});
+  }
+}
+
+GLProgram::Uniform *GLProgram::FindUniform(std::string_view name) {
+  auto it = uniforms_.find(name);
+
+  return it != uniforms_.end() ? &it->second : nullptr;
+}
+
+void GLProgram::Use() {
+  if (current_program_ == program_) return;
+
+  glUseProgram(program_);
+  current_program_ = program_;
+}
 
 template <>
 GLint GLProgram::GetUniform(const char *name) {
-  auto location = glGetUniformLocation(program_, name);
+  GLint val = 0;
 
-  GLint val;
-  glGetUniformiv(program_, location, &val);
+  if (Uniform *uniform = FindUniform(name))
+    glGetUniformiv(program_, uniform->location, &val);
 
   return val;
 }
 
 template <>
 float GLProgram::GetUniform(const char *name) {
-  auto location = glGetUniformLocation(program_, name);
+  float val = 0;
 
-  float val;
-  glGetUniformfv(program_, location, &val);
+  if (Uniform *uniform = FindUniform(name))
+    glGetUniformfv(program_, uniform->location, &val);
 
   return val;
 }
 
 template <>
 glm::mat4 GLProgram::GetUniform(const char *name) {
-  auto location = glGetUniformLocation(program_, name);
+  glm::mat4 val(0);
 
-  glm::mat4 val;
-  glGetUniformfv(program_, location, &val[0][0]);
+  if (Uniform *uniform = FindUniform(name))
+    glGetUniformfv(program_, uniform->location, &val[0][0]);
 
   return val;
 }
 
+// glProgramUniform* writes to this program even when another one is bound,
+// which keeps the cached values in sync with the GL state.
+
 template <>
 void GLProgram::SetUniform(const char *name, GLint value) {
-  auto location = glGetUniformLocation(program_, name);
+  if (Uniform *uniform = FindUniform(name); uniform && uniform->Update(value))
+    glProgramUniform1i(program_, uniform->location, value);
+}
 
-  glUniform1i(location, value);
+template <>
+void GLProgram::SetUniform(const char *name, GLuint value) {
+  if (Uniform *uniform = FindUniform(name); uniform && uniform->Update(value))
+    glProgramUniform1ui(program_, uniform->location, value);
 }
 
 template <>
 void GLProgram::SetUniform(const char *name, float value) {
-  auto location = glGetUniformLocation(program_, name);
-
-  glUniform1f(location, value);
+  if (Uniform *uniform = FindUniform(name); uniform && uniform->Update(value))
+    glProgramUniform1f(program_, uniform->location, value);
 }
 
 template <>
 void GLProgram::SetUniform(const char *name, glm::mat4 value) {
-  auto location = glGetUniformLocation(program_, name);
+  if (Uniform *uniform = FindUniform(name); uniform && uniform->Update(value))
+    glProgramUniformMatrix4fv(program_, uniform->location, 1, false,
+                              &value[0][0]);
+}
 
-  glUniformMatrix4fv(location, 1, false, &value[0][0]);
+template <>
+void GLProgram::SetUniform(const char *name, glm::vec2 value) {
+  if (Uniform *uniform = FindUniform(name); uniform && uniform->Update(value))
+    glProgramUniform2f(program_, uniform->location, value.x, value.y);
 }
 
 }  // namespace bitty
\ No newline at end of file
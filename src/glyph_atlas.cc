@@ -0,0 +1,413 @@
+#include "glyph_atlas.hh"
+
+#include <glad/gl.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "config.hh"
+#include "frame_stats.hh"
+
+namespace bitty {
+bool CharsetBuffer::Render(const GlyphBitmap &glyph, i32 x, i32 y, Cell chr) {
+  const auto &renderer = FontRenderer::Get();
+
+  // Coverage goes into single channel pages, color into BGRA ones
+  size_t bytes_per_pixel = glyph.color ? 4 : 1;
+  if (bytes_per_pixel != bytes_per_pixel_) return false;
+
+  i32 x_offset = glyph.left;
+  i32 y_offset = renderer.FontBaselineY() - glyph.top;
+
+  u32 segment_offset = chr.segment_index * renderer.CellWidthPx();
+
+  i32 right_border = x + renderer.CellWidthPx();
+  i32 bottom_border = y + renderer.CellHeightPx();
+
+  for (u32 Y = 0; Y < glyph.rows; Y++) {
+    for (u32 X = 0; X < glyph.width; X++) {
+      if (auto x_inside_bmp = X + segment_offset; x_inside_bmp < glyph.width) {
+        const u8 *pix = glyph.pixels.data() +
+                        (x_inside_bmp + Y * glyph.width) * bytes_per_pixel;
+
+        i32 total_x = X + x + x_offset;
+        i32 total_y = Y + y + y_offset;
+
+        if (total_x >= x && total_y >= y && total_x < right_border &&
+            total_y < bottom_border)
+          std::memcpy(buffer_.get() +
+                          (total_x + total_y * width_px_) * bytes_per_pixel_,
+                      pix, bytes_per_pixel);
+      }
+    }
+  }
+
+  return true;
+}
+
+void CharsetBuffer::Clear(size_t x, size_t y, size_t width, size_t height) {
+  for (size_t row = y; row < y + height; row++)
+    std::memset(buffer_.get() + (row * width_px_ + x) * bytes_per_pixel_, 0,
+                width * bytes_per_pixel_);
+}
+
+void CharsetBuffer::CopyIn(size_t x, size_t y, size_t width, size_t height,
+                           const u8 *src) {
+  size_t row_bytes = width * bytes_per_pixel_;
+
+  for (size_t row = 0; row < height; row++)
+    std::memcpy(
+        buffer_.get() + ((y + row) * width_px_ + x) * bytes_per_pixel_,
+        src + row * row_bytes, row_bytes);
+}
+
+void CharsetBuffer::CopyOut(size_t x, size_t y, size_t width, size_t height,
+                            u8 *dst) const {
+  size_t row_bytes = width * bytes_per_pixel_;
+
+  for (size_t row = 0; row < height; row++)
+    std::memcpy(
+        dst + row * row_bytes,
+        buffer_.get() + ((y + row) * width_px_ + x) * bytes_per_pixel_,
+        row_bytes);
+}
+
+GlyphAtlas::GlyphAtlas(GLenum internal_format, GLenum format,
+                       size_t bytes_per_pixel, size_t width_in_chars,
+                       size_t height_in_chars, size_t memory_limit,
+                       u32 max_slots)
+    : internal_format_(internal_format),
+      format_(format),
+      bytes_per_pixel_(bytes_per_pixel),
+      use_upload_buffer_(Config::Get().AtlasUploadPbo()),
+      width_in_chars_(width_in_chars),
+      height_in_chars_(height_in_chars),
+      max_slots_(max_slots),
+      allocator_(0) {
+  const auto &renderer = FontRenderer::Get();
+
+  size_t page_bytes = renderer.CellWidthPx() * width_in_chars *
+                      renderer.CellHeightPx() * height_in_chars *
+                      bytes_per_pixel;
+
+  max_pages_ = std::clamp<size_t>(memory_limit / page_bytes, 1,
+                                  max_slots / SlotsPerPage());
+}
+
+GlyphAtlas::~GlyphAtlas() {
+  if (texture_id_) glDeleteTextures(1, &texture_id_);
+  if (upload_buffer_) glDeleteBuffers(1, &upload_buffer_);
+}
+
+bool GlyphAtlas::AddPage() {
+  if ((pages_.size() + 1) * SlotsPerPage() > max_slots_) return false;
+
+  const auto &renderer = FontRenderer::Get();
+
+  pages_.emplace_back(renderer.CellWidthPx() * width_in_chars_,
+                      renderer.CellHeightPx() * height_in_chars_,
+                      bytes_per_pixel_);
+
+  size_t slots = pages_.size() * SlotsPerPage();
+
+  allocator_.Grow(slots);
+  slot_cells_.resize(slots);
+  last_used_.resize(slots, 0);
+
+  return true;
+}
+
+bool GlyphAtlas::EvictUnused(u64 round, std::vector<Cell> &evicted) {
+  std::vector<u32> candidates;
+
+  for (u32 slot = 0; slot < slot_cells_.size(); slot++)
+    if (slot_cells_[slot] && last_used_[slot] < round)
+      candidates.push_back(slot);
+
+  if (candidates.empty()) return false;
+
+  // An eighth at a time, so a full atlas is not rescanned for every glyph
+  size_t count = std::max<size_t>(1, candidates.size() / 8);
+
+  std::nth_element(candidates.begin(), candidates.begin() + count - 1,
+                   candidates.end(), [&](u32 a, u32 b) {
+                     return last_used_[a] < last_used_[b];
+                   });
+
+  for (size_t i = 0; i < count; i++) {
+    u32 slot = candidates[i];
+
+    evicted.push_back(*slot_cells_[slot]);
+    slot_cells_[slot].reset();
+    allocator_.Free(slot);
+  }
+
+  return true;
+}
+
+std::optional<u32> GlyphAtlas::Allocate(Cell chr, u64 round,
+                                        std::vector<Cell> &evicted) {
+  std::optional<u32> slot = allocator_.Allocate();
+
+  if (!slot) {
+    if (pages_.size() < max_pages_ || !EvictUnused(round, evicted)) {
+      // Glyphs used in this round are never evicted, so the limit gives way
+      // rather than have them render as garbage.
+      if (pages_.size() >= max_pages_ && !warned_over_limit_) {
+        LogWarning() << "Glyph atlas exceeds atlas_memory_limit_mb, as every "
+                        "glyph in it was used in this frame\n";
+        warned_over_limit_ = true;
+      }
+
+      if (!AddPage()) return std::nullopt;
+    }
+
+    slot = allocator_.Allocate();
+  }
+
+  if (slot) {
+    slot_cells_[*slot] = chr;
+    last_used_[*slot] = round;
+  }
+
+  return slot;
+}
+
+void GlyphAtlas::Free(u32 slot) {
+  slot_cells_[slot].reset();
+  allocator_.Free(slot);
+}
+
+std::tuple<u32, u32, u32> GlyphAtlas::SlotOrigin(u32 slot) const {
+  const auto &renderer = FontRenderer::Get();
+
+  u32 page_slot = slot % SlotsPerPage();
+
+  return {slot / SlotsPerPage(),
+          page_slot % width_in_chars_ * renderer.CellWidthPx(),
+          page_slot / width_in_chars_ * renderer.CellHeightPx()};
+}
+
+void GlyphAtlas::Render(u32 slot, const std::optional<GlyphBitmap> &glyph,
+                        Cell chr) {
+  const auto &renderer = FontRenderer::Get();
+  auto [page, x, y] = SlotOrigin(slot);
+
+  // An evicted glyph may have left pixels that the new one does not cover
+  pages_[page].Clear(x, y, renderer.CellWidthPx(), renderer.CellHeightPx());
+
+  if (glyph) pages_[page].Render(*glyph, x, y, chr);
+
+  dirty_slots_.push_back(slot);
+}
+
+bool GlyphAtlas::HasRoom() const {
+  return allocator_.Allocated() < allocator_.MaxCount() ||
+         pages_.size() < max_pages_;
+}
+
+void GlyphAtlas::LoadTile(u32 slot, const u8 *tile) {
+  const auto &renderer = FontRenderer::Get();
+  auto [page, x, y] = SlotOrigin(slot);
+
+  pages_[page].CopyIn(x, y, renderer.CellWidthPx(), renderer.CellHeightPx(),
+                      tile);
+
+  dirty_slots_.push_back(slot);
+}
+
+void GlyphAtlas::ReadTile(u32 slot, u8 *tile) const {
+  const auto &renderer = FontRenderer::Get();
+  auto [page, x, y] = SlotOrigin(slot);
+
+  pages_[page].CopyOut(x, y, renderer.CellWidthPx(), renderer.CellHeightPx(),
+                       tile);
+}
+
+bool GlyphAtlas::GrowTexture() {
+  const auto &first = pages_.front();
+  u32 width = first.WidthPx(), height = first.HeightPx();
+
+  // Doubling keeps the number of copies low while growing; past the limit
+  // the atlas only grows a page at a time.
+  u32 layers = std::max<u32>(
+      pages_.size(), std::min<u32>(texture_layers_ * 2, max_pages_));
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internal_format_, width, height,
+                 layers);
+
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+  float color[4] = {};
+  glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, color);
+
+  // Pages already on the GPU are copied there rather than uploaded again
+  if (uploaded_pages_)
+    glCopyImageSubData(texture_id_, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, texture,
+                       GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height,
+                       uploaded_pages_);
+
+  if (texture_id_) glDeleteTextures(1, &texture_id_);
+
+  texture_id_ = texture;
+  texture_layers_ = layers;
+
+  return true;
+}
+
+size_t GlyphAtlas::UploadSlots() {
+  if (dirty_slots_.empty()) return 0;
+
+  std::sort(dirty_slots_.begin(), dirty_slots_.end());
+  dirty_slots_.erase(std::unique(dirty_slots_.begin(), dirty_slots_.end()),
+                     dirty_slots_.end());
+
+  const auto &renderer = FontRenderer::Get();
+  u32 cell_width = renderer.CellWidthPx();
+  u32 cell_height = renderer.CellHeightPx();
+
+  // Slots next to each other in a row of a page go up as one rectangle
+  struct Run {
+    u32 page, x, y, width;  // x and width in cells
+  };
+
+  std::vector<Run> runs;
+
+  for (u32 slot : dirty_slots_) {
+    u32 page = slot / SlotsPerPage(), page_slot = slot % SlotsPerPage();
+    u32 x = page_slot % width_in_chars_, y = page_slot / width_in_chars_;
+
+    if (!runs.empty() && runs.back().page == page && runs.back().y == y &&
+        runs.back().x + runs.back().width == x)
+      runs.back().width++;
+    else
+      runs.push_back(Run{page, x, y, 1});
+  }
+
+  dirty_slots_.clear();
+
+  size_t page_width = pages_.front().WidthPx();
+  size_t total_bytes = 0;
+
+  for (const Run &run : runs)
+    total_bytes += run.width * cell_width * cell_height * bytes_per_pixel_;
+
+  auto source = [&](const Run &run) {
+    return pages_[run.page].Pixels() +
+           (run.y * cell_height * page_width + run.x * cell_width) *
+               bytes_per_pixel_;
+  };
+
+  std::byte *mapped = nullptr;
+
+  if (use_upload_buffer_) {
+    if (!upload_buffer_) glGenBuffers(1, &upload_buffer_);
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_buffer_);
+
+    // Orphaned every time, so the driver never waits for the last upload
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, total_bytes, nullptr, GL_STREAM_DRAW);
+    mapped = (std::byte *)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, total_bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+    if (!mapped) {
+      LogWarning() << "Mapping the atlas upload buffer failed, uploading "
+                      "glyphs directly\n";
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      use_upload_buffer_ = false;
+    }
+  }
+
+  if (mapped) {
+    // Rows of each run are packed one after another
+    size_t offset = 0;
+    std::vector<size_t> offsets;
+
+    for (const Run &run : runs) {
+      size_t row_bytes = run.width * cell_width * bytes_per_pixel_;
+      const u8 *src = source(run);
+
+      offsets.push_back(offset);
+
+      for (u32 row = 0; row < cell_height; row++, offset += row_bytes)
+        std::memcpy(mapped + offset, src + row * page_width * bytes_per_pixel_,
+                    row_bytes);
+    }
+
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    for (size_t i = 0; i < runs.size(); i++)
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, runs[i].x * cell_width,
+                      runs[i].y * cell_height, runs[i].page,
+                      runs[i].width * cell_width, cell_height, 1, format_,
+                      GL_UNSIGNED_BYTE, (const void *)offsets[i]);
+
+    // Left bound, it would turn every other pixel upload into a buffer read
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  } else {
+    // Straight out of the page, which is wider than the run
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, page_width);
+
+    for (const Run &run : runs)
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, run.x * cell_width,
+                      run.y * cell_height, run.page, run.width * cell_width,
+                      cell_height, 1, format_, GL_UNSIGNED_BYTE, source(run));
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  }
+
+  return total_bytes;
+}
+
+size_t GlyphAtlas::Upload() {
+  bool grow = pages_.size() > texture_layers_;
+
+  if (!grow && uploaded_pages_ == pages_.size() && dirty_slots_.empty())
+    return 0;
+
+  if (grow)
+    GrowTexture();
+  else
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id_);
+
+  // Single channel rows are not 4-byte aligned in general
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  size_t bytes = 0;
+
+  // New pages go up whole once, so that the slots around their glyphs are
+  // defined as well. Their glyphs need no upload of their own.
+  if (uploaded_pages_ < pages_.size()) {
+    u32 first_new_slot = uploaded_pages_ * SlotsPerPage();
+
+    std::erase_if(dirty_slots_,
+                  [&](u32 slot) { return slot >= first_new_slot; });
+
+    for (; uploaded_pages_ < pages_.size(); uploaded_pages_++) {
+      CharsetBuffer &buffer = pages_[uploaded_pages_];
+
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, uploaded_pages_,
+                      buffer.WidthPx(), buffer.HeightPx(), 1, format_,
+                      GL_UNSIGNED_BYTE, buffer.Pixels());
+
+      bytes += buffer.WidthPx() * buffer.HeightPx() * bytes_per_pixel_;
+    }
+  }
+
+  bytes += UploadSlots();
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  FrameStats::Get().Current().atlas_bytes += bytes;
+
+  return bytes;
+}
+}  // namespace bitty
@@ -0,0 +1,152 @@
+#include "glyph_cache.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "config.hh"
+
+namespace bitty {
+namespace {
+constexpr u32 kMagic = 0x43474221;  // "!BGC"
+constexpr u32 kVersion = 1;
+
+struct FileHeader {
+  u32 magic, version;
+  u64 key;
+  u32 cell_width, cell_height, count, reserved;
+};
+
+// Followed by the tile, one or four bytes per pixel as color says
+struct FileEntry {
+  u32 displayed_code, true_code;
+  u16 flags, segment_index, segment_count;
+  u8 color, reserved;
+};
+
+static_assert(sizeof(FileHeader) == 32 && sizeof(FileEntry) == 16);
+
+size_t TileBytes(u32 cell_width, u32 cell_height, bool color) {
+  return size_t(cell_width) * cell_height * (color ? 4 : 1);
+}
+}  // namespace
+
+std::filesystem::path GlyphCache::Path() {
+  return GetCacheDirectory() / "glyphs.bin";
+}
+
+GlyphCache::GlyphCache(u64 key, u32 cell_width, u32 cell_height) {
+  int fd = open(Path().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+
+  ScopeGuard close_fd([&] { close(fd); });
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(FileHeader)) return;
+
+  void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) return;
+
+  mapping_ = mapping;
+  size_ = st.st_size;
+
+  const auto *data = (const u8 *)mapping_;
+
+  FileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+
+  if (header.magic != kMagic || header.version != kVersion ||
+      header.key != key || header.cell_width != cell_width ||
+      header.cell_height != cell_height)
+    return;
+
+  size_t offset = sizeof(header);
+
+  for (u32 i = 0; i < header.count; i++) {
+    FileEntry entry;
+
+    if (offset + sizeof(entry) > size_) break;
+
+    std::memcpy(&entry, data + offset, sizeof(entry));
+    offset += sizeof(entry);
+
+    size_t tile_bytes = TileBytes(cell_width, cell_height, entry.color);
+
+    // A truncated file still gives the glyphs before the cut
+    if (offset + tile_bytes > size_) break;
+
+    Cell chr(entry.displayed_code, entry.flags, entry.segment_index,
+             entry.segment_count);
+    chr.true_code = entry.true_code;
+
+    entries_.push_back(Entry{chr, bool(entry.color), data + offset});
+    offset += tile_bytes;
+  }
+}
+
+GlyphCache::~GlyphCache() {
+  if (mapping_) munmap(mapping_, size_);
+}
+
+bool GlyphCache::Write(u64 key, u32 cell_width, u32 cell_height,
+                       const std::vector<Entry> &entries) {
+  std::filesystem::path path = Path();
+  std::filesystem::path temp_path = path;
+  // Two instances saving at once each write a file of their own
+  temp_path += "." + std::to_string(getpid()) + ".tmp";
+
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+
+    FileHeader header{.magic = kMagic,
+                      .version = kVersion,
+                      .key = key,
+                      .cell_width = cell_width,
+                      .cell_height = cell_height,
+                      .count = u32(entries.size()),
+                      .reserved = 0};
+
+    file.write((const char *)&header, sizeof(header));
+
+    for (const Entry &entry : entries) {
+      FileEntry file_entry{.displayed_code = entry.chr.displayed_code,
+                           .true_code = entry.chr.true_code,
+                           .flags = entry.chr.flags,
+                           .segment_index = entry.chr.segment_index,
+                           .segment_count = entry.chr.segment_count,
+                           .color = entry.color,
+                           .reserved = 0};
+
+      file.write((const char *)&file_entry, sizeof(file_entry));
+      file.write((const char *)entry.tile,
+                 TileBytes(cell_width, cell_height, entry.color));
+    }
+
+    if (!file) {
+      LogWarning() << "Failed to write the glyph cache to " << temp_path
+                   << '\n';
+      std::filesystem::remove(temp_path, error);
+      return false;
+    }
+  }
+
+  // Replaced in one step, so a running instance never maps half a file
+  std::filesystem::rename(temp_path, path, error);
+
+  if (error) {
+    LogWarning() << "Failed to replace " << path << ": " << error.message()
+                 << '\n';
+    return false;
+  }
+
+  return true;
+}
+}  // namespace bitty
@@ -0,0 +1,80 @@
+#include "glyph_rasterizer.hh"
+
+#include <utility>
+
+namespace bitty {
+GlyphRasterizer::GlyphRasterizer(u32 threads, std::function<void()> on_ready)
+    : on_ready_(std::move(on_ready)) {
+  for (u32 i = 0; i < threads; i++) workers_.emplace_back([this] { Work(); });
+}
+
+GlyphRasterizer::~GlyphRasterizer() {
+  {
+    std::unique_lock lock{mutex_};
+    stopping_ = true;
+  }
+
+  requested_.notify_all();
+
+  for (auto &worker : workers_) worker.join();
+}
+
+void GlyphRasterizer::Work() {
+  for (;;) {
+    Cell chr;
+    u64 generation;
+
+    {
+      std::unique_lock lock{mutex_};
+      requested_.wait(lock, [&] { return stopping_ || !requests_.empty(); });
+
+      if (stopping_) return;
+
+      chr = requests_.front();
+      requests_.pop_front();
+      generation = generation_;
+    }
+
+    // Loads this thread's own faces on first use
+    std::optional<GlyphBitmap> glyph = FontRenderer::Get().RenderGlyph(chr);
+    bool first;
+
+    {
+      std::unique_lock lock{mutex_};
+      if (generation != generation_) continue;
+
+      results_.push_back(Result{chr, std::move(glyph)});
+      first = results_.size() == 1;
+    }
+
+    // Once per batch, the render thread takes everything there is anyway
+    if (first && on_ready_) on_ready_();
+  }
+}
+
+void GlyphRasterizer::Request(Cell chr) {
+  {
+    std::unique_lock lock{mutex_};
+    requests_.push_back(chr);
+  }
+
+  requested_.notify_one();
+}
+
+std::vector<GlyphRasterizer::Result> GlyphRasterizer::TakeResults() {
+  std::vector<Result> results;
+
+  std::unique_lock lock{mutex_};
+  std::swap(results, results_);
+
+  return results;
+}
+
+void GlyphRasterizer::Discard() {
+  std::unique_lock lock{mutex_};
+
+  requests_.clear();
+  results_.clear();
+  generation_++;
+}
+}  // namespace bitty
@@ -0,0 +1,118 @@
+#include "grapheme.hh"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "char_width.hh"
+
+namespace bitty {
+namespace {
+constexpr char32_t kZeroWidthJoiner = 0x200D;
+
+// Below this many graphemes the table is not worth sweeping
+constexpr size_t kMinSweepSize = 4096;
+
+std::mutex graphemes_mutex;
+std::unordered_map<std::u32string, u32> grapheme_ids;
+// Empty where the id was freed
+std::vector<std::u32string> graphemes;
+std::vector<u32> free_ids;
+size_t swept_size = 0;  // Graphemes left by the last sweep
+
+constexpr bool IsRegionalIndicator(char32_t codepoint) {
+  return codepoint >= 0x1F1E6 && codepoint <= 0x1F1FF;
+}
+
+constexpr bool IsEmojiModifier(char32_t codepoint) {
+  return codepoint >= 0x1F3FB && codepoint <= 0x1F3FF;
+}
+
+// Blocks that make up nearly all of Extended_Pictographic
+constexpr bool IsPictographic(char32_t codepoint) {
+  return (codepoint >= 0x1F000 && codepoint <= 0x1FAFF &&
+          !IsRegionalIndicator(codepoint) && !IsEmojiModifier(codepoint)) ||
+         (codepoint >= 0x2600 && codepoint <= 0x27BF) ||
+         (codepoint >= 0x2300 && codepoint <= 0x23FF) ||
+         (codepoint >= 0x2B00 && codepoint <= 0x2BFF) ||
+         (codepoint >= 0x2190 && codepoint <= 0x21FF) ||
+         codepoint == 0x00A9 || codepoint == 0x00AE || codepoint == 0x203C ||
+         codepoint == 0x2049 || codepoint == 0x2122 || codepoint == 0x2139 ||
+         codepoint == 0x3030 || codepoint == 0x303D || codepoint == 0x3297 ||
+         codepoint == 0x3299;
+}
+}  // namespace
+
+u32 InternGrapheme(const std::u32string &text) {
+  std::unique_lock lock{graphemes_mutex};
+
+  if (auto found = grapheme_ids.find(text); found != grapheme_ids.end())
+    return found->second;
+
+  u32 id;
+
+  if (!free_ids.empty()) {
+    id = free_ids.back();
+    free_ids.pop_back();
+    graphemes[id - 1] = text;
+  } else {
+    graphemes.push_back(text);
+    id = graphemes.size();
+  }
+
+  grapheme_ids.emplace(text, id);
+
+  return id;
+}
+
+std::optional<std::u32string> FindGrapheme(u32 id) {
+  std::unique_lock lock{graphemes_mutex};
+
+  if (id == 0 || id > graphemes.size() || graphemes[id - 1].empty())
+    return std::nullopt;
+
+  return graphemes[id - 1];
+}
+
+bool GraphemeSweepDue() {
+  std::unique_lock lock{graphemes_mutex};
+
+  return grapheme_ids.size() >= std::max(kMinSweepSize, 2 * swept_size);
+}
+
+std::vector<u32> SweepGraphemes(const std::vector<bool> &live) {
+  std::unique_lock lock{graphemes_mutex};
+
+  std::vector<u32> freed;
+
+  for (u32 id = 1; id <= graphemes.size(); id++) {
+    std::u32string &text = graphemes[id - 1];
+    if ((id < live.size() && live[id]) || text.empty()) continue;
+
+    grapheme_ids.erase(text);
+    text.clear();
+    free_ids.push_back(id);
+    freed.push_back(id);
+  }
+
+  swept_size = grapheme_ids.size();
+
+  return freed;
+}
+
+bool ContinuesGrapheme(const std::u32string &text, char32_t codepoint) {
+  if (text.empty()) return false;
+
+  // Controls are zero width too, but always break
+  if (codepoint >= 0xA0 && CodePointWidth(codepoint) == 0) return true;
+
+  if (IsEmojiModifier(codepoint)) return IsPictographic(text.back());
+
+  if (IsRegionalIndicator(codepoint))
+    return text.size() == 1 && IsRegionalIndicator(text[0]);
+
+  return text.back() == kZeroWidthJoiner && IsPictographic(text[0]) &&
+         IsPictographic(codepoint);
+}
+}  // namespace bitty
@@ -0,0 +1,380 @@
+#include <dlfcn.h>
+#include <glad/egl.h>
+#include <glad/gl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cell_buffer.hh"
+#include "font_renderer.hh"
+#include "frame_stats.hh"
+#include "png_io.hh"
+#include "render_context.hh"
+#include "retained_frame.hh"
+#include "term_renderer.hh"
+#include "terminal.hh"
+#include "util.hh"
+
+// Renders a recorded pty session without a window, through a surfaceless or
+// pbuffer EGL context. Software drivers such as llvmpipe are enough, which
+// makes it usable for golden image tests and render benchmarks in CI.
+
+using namespace bitty;
+
+namespace {
+// Not in the generated loader
+constexpr EGLenum kPlatformSurfacelessMESA = 0x31DD;
+
+struct Options {
+  std::string capture_path, png_path, golden_path;
+  u32 cols{80}, rows{24};
+  size_t chunk_size{0};  // 0 feeds the whole capture in one frame
+  u32 repeat{1};
+  bool full_redraw{false};
+};
+
+void PrintUsage() {
+  fprintf(stderr,
+          "usage: bitty-headless [options] <capture>\n"
+          "  --cols N         terminal width in cells (80)\n"
+          "  --rows N         terminal height in cells (24)\n"
+          "  --png PATH       write the last frame to PATH\n"
+          "  --golden PATH    compare the last frame with PATH\n"
+          "  --chunk BYTES    feed BYTES of the capture per frame\n"
+          "  --repeat N       replay the capture N times\n"
+          "  --full-redraw    repaint every frame in full\n");
+}
+
+// The whole of text as a number, or nothing
+template <typename T>
+std::optional<T> ParseNumber(std::string_view text) {
+  T value{};
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+
+  if (error != std::errc{} || end != text.data() + text.size())
+    return std::nullopt;
+
+  return value;
+}
+
+std::optional<Options> ParseOptions(int argc, char **argv) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    // Stores the next argument into value, complaining if it is no number
+    auto number = [&]<typename T>(T &value) {
+      std::optional<T> parsed = ParseNumber<T>(argv[++i]);
+
+      if (!parsed)
+        fprintf(stderr, "bitty-headless: %.*s expects a number, got '%s'\n",
+                int(arg.size()), arg.data(), argv[i]);
+      else
+        value = *parsed;
+
+      return parsed.has_value();
+    };
+
+    if (arg == "--cols" && has_value) {
+      if (!number(options.cols)) return std::nullopt;
+    } else if (arg == "--rows" && has_value) {
+      if (!number(options.rows)) return std::nullopt;
+    } else if (arg == "--png" && has_value)
+      options.png_path = argv[++i];
+    else if (arg == "--golden" && has_value)
+      options.golden_path = argv[++i];
+    else if (arg == "--chunk" && has_value) {
+      if (!number(options.chunk_size)) return std::nullopt;
+    } else if (arg == "--repeat" && has_value) {
+      if (!number(options.repeat)) return std::nullopt;
+      options.repeat = std::max(1u, options.repeat);
+    } else if (arg == "--full-redraw")
+      options.full_redraw = true;
+    else if (!arg.starts_with("--") && options.capture_path.empty())
+      options.capture_path = arg;
+    else
+      return std::nullopt;
+  }
+
+  if (options.capture_path.empty() || !options.cols || !options.rows)
+    return std::nullopt;
+
+  return options;
+}
+
+bool HasExtension(const char *extensions, std::string_view name) {
+  if (!extensions) return false;
+
+  std::string_view list(extensions);
+
+  for (size_t pos = list.find(name); pos != list.npos;
+       pos = list.find(name, pos + 1)) {
+    bool starts = pos == 0 || list[pos - 1] == ' ';
+    bool ends =
+        pos + name.size() == list.size() || list[pos + name.size()] == ' ';
+
+    if (starts && ends) return true;
+  }
+
+  return false;
+}
+
+// Makes a GL 4.4 core context current. The surface is only there to satisfy
+// drivers without EGL_KHR_surfaceless_context, everything is drawn into a
+// RetainedFrame.
+bool CreateContext() {
+  // glad is generated without its own loader, so libEGL is opened by hand
+  void *libegl = dlopen("libEGL.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (!libegl) {
+    LogError() << "Failed to load libEGL.so.1: " << dlerror() << '\n';
+    return false;
+  }
+
+  auto get_proc_address = (GLADloadfunc)dlsym(libegl, "eglGetProcAddress");
+
+  if (!get_proc_address || !gladLoadEGL(EGL_NO_DISPLAY, get_proc_address)) {
+    LogError() << "Failed to load EGL\n";
+    return false;
+  }
+
+  EGLDisplay display = EGL_NO_DISPLAY;
+
+  if (eglGetPlatformDisplay &&
+      HasExtension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS),
+                   "EGL_MESA_platform_surfaceless"))
+    display = eglGetPlatformDisplay(kPlatformSurfacelessMESA,
+                                    EGL_DEFAULT_DISPLAY, nullptr);
+
+  if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    LogError() << "Failed to initialize an EGL display\n";
+    return false;
+  }
+
+  // Now with the display's own extensions
+  gladLoadEGL(display, get_proc_address);
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    LogError() << "EGL display does not support desktop OpenGL\n";
+    return false;
+  }
+
+  const EGLint config_attribs[] = {EGL_SURFACE_TYPE,
+                                   EGL_PBUFFER_BIT,
+                                   EGL_RENDERABLE_TYPE,
+                                   EGL_OPENGL_BIT,
+                                   EGL_RED_SIZE,
+                                   8,
+                                   EGL_GREEN_SIZE,
+                                   8,
+                                   EGL_BLUE_SIZE,
+                                   8,
+                                   EGL_ALPHA_SIZE,
+                                   8,
+                                   EGL_NONE};
+
+  EGLConfig config;
+  EGLint config_count = 0;
+
+  if (!eglChooseConfig(display, config_attribs, &config, 1, &config_count) ||
+      !config_count) {
+    LogError() << "No EGL config with an OpenGL pbuffer\n";
+    return false;
+  }
+
+  const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                    4,
+                                    EGL_CONTEXT_MINOR_VERSION,
+                                    4,
+                                    EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                    EGL_NONE};
+
+  EGLContext context =
+      eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+
+  if (context == EGL_NO_CONTEXT) {
+    LogError() << "Failed to create a GL 4.4 core context\n";
+    return false;
+  }
+
+  EGLSurface surface = EGL_NO_SURFACE;
+
+  if (!HasExtension(eglQueryString(display, EGL_EXTENSIONS),
+                    "EGL_KHR_surfaceless_context")) {
+    const EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+  }
+
+  if (!eglMakeCurrent(display, surface, surface, context)) {
+    LogError() << "Failed to make the EGL context current\n";
+    return false;
+  }
+
+  if (!gladLoadGL((GLADloadfunc)eglGetProcAddress)) {
+    LogError() << "Failed to load OpenGL\n";
+    return false;
+  }
+
+  LogInfo() << "Rendering with " << (const char *)glGetString(GL_RENDERER)
+            << " through EGL " << major << '.' << minor << '\n';
+
+  return true;
+}
+
+std::optional<std::vector<char>> ReadCapture(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+
+  if (!file) {
+    LogError() << "Failed to open " << path << '\n';
+    return std::nullopt;
+  }
+
+  return std::vector<char>(std::istreambuf_iterator<char>(file), {});
+}
+
+// Returns the number of pixels that differ, or -1 if the sizes do
+i64 ComparePixels(const RgbaImage &a, const RgbaImage &b) {
+  if (a.width != b.width || a.height != b.height) return -1;
+
+  i64 different = 0;
+
+  for (size_t i = 0; i < a.pixels.size(); i += 4)
+    different += std::memcmp(&a.pixels[i], &b.pixels[i], 4) != 0;
+
+  return different;
+}
+
+inline double NsToMs(u64 ns) { return ns / 1e6; }
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::optional<Options> options = ParseOptions(argc, argv);
+
+  if (!options) {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  std::optional<std::vector<char>> capture =
+      ReadCapture(options->capture_path);
+
+  if (!capture || !CreateContext()) return EXIT_FAILURE;
+
+  EnableGLDebugOutput();
+
+  RenderContext render_context;
+  TermRenderer renderer(render_context);
+  RetainedFrame frame;
+
+  auto terminal = Terminal::Get(
+                      Terminal::CreateDetached(options->cols, options->rows))
+                      .value();
+
+  u32 width = options->cols * GlobalCellWidthPx();
+  u32 height = options->rows * GlobalCellHeightPx();
+
+  frame.Resize(width, height);
+  frame.Bind();
+
+  FrameStats &stats = FrameStats::Get();
+  size_t chunk_size =
+      options->chunk_size ? options->chunk_size : capture->size();
+
+  u64 frames = 0, parse_ns = 0, render_ns = 0, cells = 0, upload_bytes = 0;
+
+  for (u32 pass = 0; pass < options->repeat; pass++) {
+    for (size_t offset = 0;; offset += chunk_size) {
+      size_t end = std::min(capture->size(), offset + chunk_size);
+
+      auto parse_start = std::chrono::steady_clock::now();
+
+      for (size_t i = offset; i < end; i++)
+        terminal->InterpretPtyInput((*capture)[i]);
+
+      auto render_start = std::chrono::steady_clock::now();
+
+      if (options->full_redraw) renderer.Invalidate();
+
+      renderer.Render(*terminal, Rect<u32>{0, 0, width, height}, height);
+      render_context.GetCharset().EndRound();
+
+      // Included in the frame time, as a window would wait for it to present
+      glFinish();
+
+      auto render_end = std::chrono::steady_clock::now();
+
+      parse_ns += std::chrono::nanoseconds(render_start - parse_start).count();
+      render_ns += std::chrono::nanoseconds(render_end - render_start).count();
+      cells += stats.Current().cells_updated;
+      upload_bytes +=
+          stats.Current().vertex_bytes + stats.Current().atlas_bytes;
+      frames++;
+
+      stats.EndFrame();
+
+      if (end == capture->size()) break;
+    }
+  }
+
+  double render_s = render_ns / 1e9;
+
+  printf("frames %llu  render %.2f ms  %.1f fps  %.3f ms/frame\n",
+         (unsigned long long)frames, NsToMs(render_ns),
+         render_s > 0 ? frames / render_s : 0., NsToMs(render_ns) / frames);
+  printf("parse %.2f ms  %.1f MiB/s  cells %llu  uploaded %llu bytes\n",
+         NsToMs(parse_ns),
+         parse_ns ? capture->size() * options->repeat / (parse_ns / 1e9) /
+                        (1024. * 1024.)
+                  : 0.,
+         (unsigned long long)cells, (unsigned long long)upload_bytes);
+
+  RgbaImage image = ReadFramebuffer(width, height);
+  int status = EXIT_SUCCESS;
+
+  if (!options->png_path.empty() && !WritePng(options->png_path, image))
+    status = EXIT_FAILURE;
+
+  if (!options->golden_path.empty()) {
+    std::optional<RgbaImage> golden = ReadPng(options->golden_path);
+    i64 different = golden ? ComparePixels(image, *golden) : -1;
+
+    if (different == 0)
+      printf("golden %s matches\n", options->golden_path.c_str());
+    else {
+      if (different < 0)
+        printf("golden %s has a different size\n",
+               options->golden_path.c_str());
+      else
+        printf("golden %s differs in %lld pixels\n",
+               options->golden_path.c_str(), (long long)different);
+
+      // Keep what was rendered around for inspection
+      if (options->png_path.empty())
+        WritePng(options->golden_path + ".actual.png", image);
+
+      status = EXIT_FAILURE;
+    }
+  }
+
+  Terminal::Destroy(terminal->Id());
+
+  return status;
+}
@@ -5,14 +5,31 @@
 
 #include "cell_buffer.hh"
 #include "events.hh"
+#include "font_preloader.hh"
 #include "font_renderer.hh"
-#include "term_renderer.hh"
+#include "frame_pacer.hh"
+#include "frame_stats.hh"
+#include "grapheme.hh"
+#include "perf_hud.hh"
+#include "render_context.hh"
+#include "retained_frame.hh"
+#include "shaper.hh"
+#include "workspace.hh"
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "terminal.hh"
 #include "util.hh"
 
@@ -69,6 +86,7 @@ using namespace bitty;
 // clang-format off
 #define GLFW_EXPOSE_NATIVE_X11
 #include <GLFW/glfw3native.h>
+#include <glad/glx.h>
 #include <X11/Intrinsic.h>
 #include <X11/Core.h>
 #include <X11/Xatom.h>
@@ -94,13 +112,61 @@ bool BlurWindow(GLFWwindow *window, int blur_radius) {
 
   return false;
 }
+
+// Age of the back buffer in frames as reported by GLX_EXT_buffer_age, or 0
+// when its contents are unknown.
+u32 QueryBufferAge(GLFWwindow *window) {
+  // Missing from the generated loader
+  constexpr int kGLXBackBufferAgeEXT = 0x20F4;
+  static int supported = -1;
+
+  Display *display = glfwGetX11Display();
+
+  if (supported < 0) {
+    int screen = DefaultScreen(display);
+
+    supported =
+        gladLoadGLX(display, screen, glfwGetProcAddress) &&
+        std::string_view(glXQueryExtensionsString(display, screen))
+                .find("GLX_EXT_buffer_age") != std::string_view::npos;
+
+    if (!supported)
+      LogInfo() << "GLX_EXT_buffer_age is unavailable, presenting full "
+                   "frames\n";
+  }
+
+  if (!supported) return 0;
+
+  unsigned int age = 0;
+  glXQueryDrawable(display, glXGetCurrentDrawable(), kGLXBackBufferAgeEXT,
+                   &age);
+
+  return age;
+}
 #else
 bool BlurWindow(GLFWwindow *window, int blur_radius) { return false; }
+
+u32 QueryBufferAge(GLFWwindow *window) { return 0; }
 #endif
 
 int main() {
   GLFWwindow *window;
 
+  // Time spent in each phase up to the first frame, logged once it is shown
+  auto startup_begin = std::chrono::steady_clock::now();
+  auto phase_begin = startup_begin;
+  std::string startup_phases;
+  bool startup_logged = false;
+
+  auto end_phase = [&](std::string_view phase) {
+    auto now = std::chrono::steady_clock::now();
+
+    startup_phases += std::format(
+        "{}{} {:.1f} ms", startup_phases.empty() ? "" : ", ", phase,
+        std::chrono::duration<double, std::milli>(now - phase_begin).count());
+    phase_begin = now;
+  };
+
   glfwSetErrorCallback(error_callback);
 
   if (!glfwInit()) exit(EXIT_FAILURE);
@@ -138,64 +204,337 @@ int main() {
 
   glfwMakeContextCurrent(window);
   gladLoadGL(glfwGetProcAddress);
-  glfwSwapInterval(0);
+  end_phase("window");
+
+  FontRenderer::Get();
+  end_phase("fonts");
+  const GLFWvidmode *monitor_mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+  FramePacer pacer(ParsePresentMode(Config::Get().PresentMode()),
+                   monitor_mode ? monitor_mode->refreshRate : 60);
+
+  glfwSwapInterval(pacer.SwapInterval());
 
   EnableGLDebugOutput();
 
-  TermRenderer renderer;
+  RenderContext render_context;
   bool needs_redraw = true;
 
+  if (u32 threads = Config::Get().RasterThreads())
+    render_context.GetCharset().StartRasterizer(threads, [] {
+      EventQueue::Get().Enqueue(EventGlyphsRasterized{});
+      glfwPostEmptyEvent();
+    });
+
+  // The first frame then finds the glyphs of the last session rasterized
+  if (Config::Get().DiskGlyphCache()) render_context.GetCharset().LoadCache();
+
+  end_phase("renderer");
+
   int width, height;
 
   glfwGetFramebufferSize(window, &width, &height);
 
-  int pty_id =
-      Terminal::Create(Config::Get().ShellPath(), width / GlobalCellWidthPx(),
-                       height / GlobalCellHeightPx());
+  Workspace workspace(render_context, Config::Get().ShellPath());
+  workspace.Layout(width, height);
+
+  if (!workspace.NewTab()) {
+    glfwTerminate();
+    exit(EXIT_FAILURE);
+  }
+
+  end_phase("shell");
+
+  Config::Get().Watch([] {
+    EventQueue::Get().Enqueue(EventConfigChanged{});
+    glfwPostEmptyEvent();
+  });
 
-  std::shared_ptr terminal{Terminal::Get(pty_id).value_or(nullptr)};
+  PerfHud hud(render_context);
+  RetainedFrame frame;
+
+  double mouse_x = 0, mouse_y = 0;
+
+  // The blink phase restarts on input so the cursor stays solid while typing.
+  double blink_interval = Config::Get().CursorBlinkInterval() / 1000.;
+  double blink_epoch = glfwGetTime();
+  bool cursor_blink_on = true;
+
+  auto update_title = [&] {
+    if (workspace.TabCount() > 1)
+      glfwSetWindowTitle(window,
+                         std::format("bitty [{}/{}]",
+                                     workspace.ActiveTabIndex() + 1,
+                                     workspace.TabCount())
+                             .c_str());
+    else
+      glfwSetWindowTitle(window, "bitty");
+  };
+
+  // Ctrl+Shift chords manage tabs and splits instead of reaching the pty.
+  auto handle_workspace_key = [&](int key) -> bool {
+    switch (key) {
+      case GLFW_KEY_T:
+        workspace.NewTab();
+        break;
+      case GLFW_KEY_W:
+        workspace.CloseFocused();
+        break;
+      case GLFW_KEY_E:
+        workspace.SplitFocused(SplitDirection::kHorizontal);
+        break;
+      case GLFW_KEY_O:
+        workspace.SplitFocused(SplitDirection::kVertical);
+        break;
+      case GLFW_KEY_PAGE_UP:
+        workspace.CycleTab(-1);
+        break;
+      case GLFW_KEY_PAGE_DOWN:
+        workspace.CycleTab(1);
+        break;
+      case GLFW_KEY_H:
+        hud.Toggle();
+        break;
+      default:
+        return false;
+    }
+
+    if (workspace.Empty())
+      glfwSetWindowShouldClose(window, GLFW_TRUE);
+    else
+      update_title();
+
+    return true;
+  };
+
+  // Zoom is 1.1 to the power of the step. A new size, or a font changed in
+  // bitty.json, is loaded and its visible glyphs rendered in the background,
+  // the current one stays on screen meanwhile; changes made in between are
+  // caught up with afterwards.
+  constexpr int kMinZoomStep = -8, kMaxZoomStep = 16;
+  int zoom_step = 0;
+  FontPreloader preloader;
+
+  auto request_font = [&] {
+    const Settings &settings = Config::Get().Snapshot();
+    double zoom = std::pow(1.1, zoom_step);
+
+    if (preloader.Busy() || FontRenderer::IsFont(settings, zoom)) return;
+
+    preloader.Start(settings, zoom, workspace.VisibleCells(), [] {
+      EventQueue::Get().Enqueue(EventFontPrepared{});
+      glfwPostEmptyEvent();
+    });
+  };
+
+  // Ctrl with = or + zooms in, with - out, and Ctrl+0 goes back to the
+  // configured font size. Held keys repeat.
+  auto handle_zoom_key = [&](int key) -> bool {
+    switch (key) {
+      case GLFW_KEY_EQUAL:
+      case GLFW_KEY_KP_ADD:
+        zoom_step++;
+        break;
+      case GLFW_KEY_MINUS:
+      case GLFW_KEY_KP_SUBTRACT:
+        zoom_step--;
+        break;
+      case GLFW_KEY_0:
+      case GLFW_KEY_KP_0:
+        zoom_step = 0;
+        break;
+      default:
+        return false;
+    }
+
+    zoom_step = std::clamp(zoom_step, kMinZoomStep, kMaxZoomStep);
+    request_font();
+
+    return true;
+  };
+
+  // Earliest input not on screen yet. Typing only counts once the pty has
+  // answered, as the echo is what the user waits for.
+  std::optional<double> input_time;
+  bool input_answered = false;
+
+  auto note_input = [&](bool answered) {
+    if (!input_time) input_time = glfwGetTime();
+    input_answered = input_answered || answered;
+  };
 
   bool set_win_size = true;
 
+  // In low latency mode a requested frame waits for its slot before the next
+  // vblank, while input keeps being processed.
+  std::optional<double> render_at;
+
   while (!glfwWindowShouldClose(window)) {
-    if (needs_redraw) {
+    // Graphemes no cell holds anymore are freed, and their glyphs forgotten
+    // before the ids come back as other graphemes
+    if (GraphemeSweepDue()) {
+      std::vector<bool> live;
+      Terminal::MarkGraphemes(live);
+      render_context.GetCharset().MarkGraphemes(live);
+      render_context.GetCharset().ForgetGraphemes(SweepGraphemes(live));
+    }
+
+    if (GlyphClusterSweepDue()) render_context.SweepGlyphClusters();
+
+    if (needs_redraw && !render_at)
+      render_at = pacer.RenderStartTime(glfwGetTime());
+
+    if (needs_redraw && glfwGetTime() >= *render_at) {
+      double frame_start = glfwGetTime();
+
+      render_at.reset();
+
       glfwGetFramebufferSize(window, &width, &height);
 
-      glViewport(0, 0, width, height);
-      glClearColor(0, 0, 0, Config::Get().Opacity());
-      glClear(GL_COLOR_BUFFER_BIT);
+      // Panes clear their own area when they repaint in full
+      if (frame.Resize(width, height)) workspace.Invalidate();
+
+      frame.Bind();
 
-      if (auto buf = terminal->CurrentBuffer()) {
-        auto [w, h] = std::tuple{buf->ScreenWidth(), buf->ScreenHeight()};
-        if (set_win_size) {
-          glfwSetWindowSize(window, w, h);
+      if (set_win_size) {
+        if (auto buf = workspace.FocusedPane()->terminal->CurrentBuffer()) {
+          glfwSetWindowSize(window, buf->ScreenWidth(), buf->ScreenHeight());
           set_win_size = false;
         }
-        renderer.Render(*terminal, width, height);
       }
 
-      glfwSwapBuffers(window);
+      FrameStats &stats = FrameStats::Get();
+      auto render_start = std::chrono::steady_clock::now();
+
+      stats.BeginGpuTimer();
+      workspace.Render(frame, cursor_blink_on);
+      stats.EndGpuTimer();
+
+      stats.Current().cpu_render_ns =
+          std::chrono::nanoseconds(std::chrono::steady_clock::now() -
+                                   render_start)
+              .count();
+      stats.EndFrame();
+
+      hud.Render(frame, width, height);
+      render_context.GetCharset().EndRound();
+
+      // Only damaged rectangles reach the back buffer, and an unchanged
+      // frame is not presented at all.
+      if (frame.Present(QueryBufferAge(window))) {
+        bool low_latency = pacer.Mode() == PresentMode::kLowLatency;
+
+        // The pacer's budget has to cover the GPU work, but not the wait for
+        // the vblank that follows.
+        if (low_latency) glFinish();
+        double rendered_at = glfwGetTime();
+
+        glfwSwapBuffers(window);
+
+        // With vsync the swap is done once the GPU is, which marks the
+        // vblank the pacer aims for.
+        if (low_latency) glFinish();
+
+        double presented_at = glfwGetTime();
+        pacer.FramePresented(rendered_at - frame_start, presented_at);
+
+        if (input_time && input_answered) {
+          stats.RecordLatency((presented_at - *input_time) * 1000);
+          input_time.reset();
+        }
+      }
+
+      if (!startup_logged) {
+        end_phase("first frame");
+        LogInfo() << std::format(
+            "Started in {:.1f} ms: {}\n",
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - startup_begin)
+                .count(),
+            startup_phases);
+        startup_logged = true;
+      }
+
+      // Input the pty never answered (keys it ignores) is not waited on
+      if (input_time && glfwGetTime() - *input_time > 1) input_time.reset();
+      if (!input_time) input_answered = false;
 
       needs_redraw = false;
     }
 
-    glfwWaitEvents();
+    bool blinking = blink_interval > 0 && workspace.HasBlinkingCursor();
+    std::optional<double> wake_at = needs_redraw ? render_at : std::nullopt;
+
+    if (blinking) {
+      double elapsed = glfwGetTime() - blink_epoch;
+      double next_toggle =
+          (std::floor(elapsed / blink_interval) + 1) * blink_interval;
+      double toggle_at = blink_epoch + next_toggle;
+
+      wake_at = wake_at ? std::min(*wake_at, toggle_at) : toggle_at;
+    }
+
+    if (!wake_at)
+      glfwWaitEvents();
+    else if (double timeout = *wake_at - glfwGetTime(); timeout > 0)
+      glfwWaitEventsTimeout(timeout);
+    else
+      glfwPollEvents();
 
     EventQueue::Get().Process(Overloaded{
         [&](EventMouseScroll scroll) mutable {
-          terminal->HandleMouseScroll(scroll);
+          if (Pane *pane = workspace.FocusedPane()) {
+            pane->terminal->HandleMouseScroll(scroll);
 
-          needs_redraw = true;
+            note_input(true);
+            needs_redraw = true;
+          }
+        },
+        [&](EventMousePos pos) mutable {
+          mouse_x = pos.new_pos_x;
+          mouse_y = pos.new_pos_y;
+
+          if (Pane *pane = workspace.FocusedPane())
+            pane->terminal->HandleMousePos(
+                EventMousePos{pos.new_pos_x - pane->area.left,
+                              pos.new_pos_y - pane->area.top});
         },
-        [&](EventMousePos pos) mutable { terminal->HandleMousePos(pos); },
         [&](EventMouseButton mouse) mutable {
-          terminal->HandleMouseButton(mouse);
+          if (mouse.action == GLFW_PRESS && mouse_x >= 0 && mouse_y >= 0)
+            workspace.FocusPaneAt(mouse_x, mouse_y);
+
+          if (Pane *pane = workspace.FocusedPane())
+            pane->terminal->HandleMouseButton(mouse);
         },
         [&](EventKeyInput keystroke) mutable {
           // LogInfo() << keystroke.action << ' ' << keystroke.key << ' '
           //           << keystroke.mods << ' ' << keystroke.scancode << '\n';
 
+          Pane *pane = workspace.FocusedPane();
+          if (!pane) return;
+
+          if (keystroke.action == GLFW_PRESS &&
+              (keystroke.mods & GLFW_MOD_CONTROL) &&
+              (keystroke.mods & GLFW_MOD_SHIFT) &&
+              handle_workspace_key(keystroke.key)) {
+            // Also uncovers whatever the HUD was drawn over
+            workspace.Invalidate();
+            note_input(true);
+            needs_redraw = true;
+            return;
+          }
+
+          if (keystroke.action != GLFW_RELEASE &&
+              (keystroke.mods & GLFW_MOD_CONTROL) &&
+              !(keystroke.mods & GLFW_MOD_ALT) &&
+              handle_zoom_key(keystroke.key))
+            return;
+
+          auto &terminal = pane->terminal;
+
           if (keystroke.action != GLFW_RELEASE) {
+            blink_epoch = glfwGetTime();
+            note_input(false);
+
             switch (keystroke.key) {
               case GLFW_KEY_ENTER:
                 terminal->WriteToPty({'\r'});
@@ -261,12 +600,16 @@ int main() {
                   terminal->WriteToPty({char(keystroke.key - GLFW_KEY_A + 1)});
                 break;
             }
-          }
 
-          needs_redraw = true;
+            needs_redraw = true;
+          }
         },
 
         [&](EventCharInput chr) mutable {
+          Pane *pane = workspace.FocusedPane();
+          if (!pane) return;
+
+          auto &terminal = pane->terminal;
           char32_t codepoint = chr.code;
 
           std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> convert;
@@ -274,13 +617,31 @@ int main() {
 
           if (terminal->IsUserScrolledUp()) terminal->TryResetUserScroll();
 
+          note_input(false);
+
           terminal->WriteToPty(std::vector(byte_str.begin(), byte_str.end()));
         },
 
         [&](EventDataFromTty data) mutable {
+          auto terminal = Terminal::Get(data.terminal_id);
+          if (!terminal.has_value()) return;
+
+          auto parse_start = std::chrono::steady_clock::now();
+
           for (size_t i = 0; i < data.byte_count; i++)
-            terminal->InterpretPtyInput((char)data.bytes[i]);
-          needs_redraw = true;
+            terminal.value()->InterpretPtyInput((char)data.bytes[i]);
+
+          FrameCounters &counters = FrameStats::Get().Current();
+          counters.parse_ns += std::chrono::nanoseconds(
+                                   std::chrono::steady_clock::now() -
+                                   parse_start)
+                                   .count();
+          counters.bytes_parsed += data.byte_count;
+
+          if (workspace.IsVisible(data.terminal_id)) {
+            if (input_time) input_answered = true;
+            needs_redraw = true;
+          }
         },
 
         [&](EventWindowResized resized) mutable {
@@ -289,14 +650,72 @@ int main() {
           u32 ch = GlobalCellHeightPx();
           u32 nw = (u32)resized.new_width / cw;
           u32 nh = (u32)resized.new_height / ch;
-          terminal->SetWindowSize(nw, nh);
           glfwSetWindowSize(window, nw * cw, nh * ch);
+          glfwGetFramebufferSize(window, &width, &height);
+          workspace.Layout(width, height);
+          needs_redraw = true;
+        },
+
+        [&](EventWindowRefreshed) mutable {
+          // The window system lost our pixels, not the retained frame
+          frame.DamageAll();
+          needs_redraw = true;
+        },
+
+        [&](EventGlyphsRasterized) mutable { needs_redraw = true; },
+
+        [&](EventFontPrepared) mutable {
+          std::optional<FontPreloader::Prepared> prepared = preloader.Take();
+          if (!prepared) return;
+
+          u32 old_cell_height = GlobalCellHeightPx();
+
+          // Between two frames, so none of them mixes both fonts. Only the
+          // faces are loaded here, FontCache has the rest from the preloader.
+          // The raster threads reload before their next glyph.
+          FontRenderer::SetFont(*prepared->settings, prepared->zoom);
+          render_context.ResetCharset();
+          render_context.GetCharset().Preload(prepared->glyphs);
+          workspace.RelayoutCells(old_cell_height);
           needs_redraw = true;
+
+          request_font();
         },
 
-        [&](EventWindowRefreshed) mutable { needs_redraw = true; }});
+        [&](EventConfigChanged) mutable {
+          Config::Get().NotifyListeners();
+          blink_interval = Config::Get().CursorBlinkInterval() / 1000.;
+
+          // Another font or size swaps in once prepared, like a zoom step
+          request_font();
+
+          workspace.Invalidate();
+          needs_redraw = true;
+        }});
+
+    if (blinking) {
+      bool phase =
+          i64((glfwGetTime() - blink_epoch) / blink_interval) % 2 == 0;
+
+      if (phase != cursor_blink_on) {
+        cursor_blink_on = phase;
+        needs_redraw = true;
+      }
+    } else
+      cursor_blink_on = true;
   }
 
+  if (FrameStats &stats = FrameStats::Get(); stats.LatencySampleCount())
+    LogInfo() << std::format(
+        "Input to present latency over {} frames: p50 {:.2f} ms, p99 {:.2f} "
+        "ms\n",
+        stats.LatencySampleCount(), stats.LatencyPercentileMs(0.5),
+        stats.LatencyPercentileMs(0.99));
+
+  Config::Get().StopWatching();
+
+  if (Config::Get().DiskGlyphCache()) render_context.GetCharset().SaveCache();
+
   glfwDestroyWindow(window);
 
   glfwTerminate();
@@ -0,0 +1,111 @@
+#include "perf_hud.hh"
+
+#include <glad/gl.h>
+
+#include <algorithm>
+#include <format>
+#include <string>
+
+#include "frame_stats.hh"
+
+namespace bitty {
+namespace {
+constexpr Color kTextColor(255, 230, 230, 230);
+constexpr Color kBackgroundColor(255, 24, 24, 32);
+constexpr Color kGraphColor(255, 110, 200, 120);
+constexpr Color kSlowFrameColor(255, 230, 110, 90);
+
+std::string FormatBytes(u64 bytes) {
+  if (bytes < 1024) return std::format("{} B", bytes);
+  if (bytes < 1024 * 1024) return std::format("{:.1f} KiB", bytes / 1024.);
+  return std::format("{:.1f} MiB", bytes / (1024. * 1024.));
+}
+
+inline double NsToMs(u64 ns) { return ns / 1e6; }
+}  // namespace
+
+PerfHud::PerfHud(RenderContext &context)
+    : buffer_(kWidth, kHeight, kHeight), renderer_(context) {}
+
+void PerfHud::Toggle() {
+  visible_ = !visible_;
+
+  // GPU timer queries are only worth issuing while somebody looks at them
+  FrameStats::Get().SetEnabled(visible_);
+}
+
+void PerfHud::WriteLine(u32 y, std::string_view text) {
+  for (u32 x = 0; x < kWidth; x++) {
+    ColoredCell cell(char32_t(x < text.size() ? text[x] : ' '), kTextColor,
+                     kBackgroundColor);
+
+    // Only cells that actually change are marked for upload
+    if (buffer_.Get(x, y) != cell) buffer_.Set(x, y, cell);
+  }
+}
+
+void PerfHud::WriteGraph(u32 top) {
+  constexpr u32 kLevels = kGraphRows * 8;
+
+  // One column per frame, the latest on the right
+  for (u32 x = 0; x < kWidth; x++) {
+    float interval = FrameStats::Get().IntervalMs(kWidth - 1 - x);
+    u32 level = std::clamp<u32>(interval / kGraphMaxMs * kLevels, 0, kLevels);
+
+    Color color = interval > kGraphMaxMs / 2 ? kSlowFrameColor : kGraphColor;
+
+    for (u32 row = 0; row < kGraphRows; row++) {
+      // Rows are filled from the bottom with U+2581 to U+2588
+      u32 row_level = std::clamp<i32>(
+          i32(level) - i32(kGraphRows - 1 - row) * 8, 0, 8);
+      char32_t code = row_level ? char32_t(0x2580 + row_level) : U' ';
+
+      ColoredCell cell(code, color, kBackgroundColor);
+
+      if (buffer_.Get(x, top + row) != cell) buffer_.Set(x, top + row, cell);
+    }
+  }
+}
+
+void PerfHud::Render(RetainedFrame &frame, u32 fb_width, u32 fb_height) {
+  if (!visible_) return;
+
+  FrameStats &stats = FrameStats::Get();
+  const FrameCounters &last = stats.Last();
+
+  // The HUD's own uploads are left out of the numbers it shows
+  FrameCounters counters = stats.Current();
+
+  float max_interval = 0;
+
+  for (u32 age = 0; age < kWidth; age++)
+    max_interval = std::max(max_interval, stats.IntervalMs(age));
+
+  WriteLine(0, std::format("parse {:6.2f} ms {:>10}", NsToMs(last.parse_ns),
+                           FormatBytes(last.bytes_parsed)));
+  WriteLine(1, std::format("cells {:>9} vbo {:>10}", last.cells_updated,
+                           FormatBytes(last.vertex_bytes)));
+  WriteLine(2, std::format("atlas {:>9} lat {:4.1f}/{:4.1f}",
+                           FormatBytes(last.atlas_bytes),
+                           stats.LatencyPercentileMs(0.5),
+                           stats.LatencyPercentileMs(0.99)));
+  WriteLine(3, std::format("cpu {:6.2f} ms gpu {:6.2f} ms",
+                           NsToMs(last.cpu_render_ns),
+                           NsToMs(stats.GpuTimeNs())));
+  WriteLine(4, std::format("frame {:6.2f} ms max {:6.2f}", stats.IntervalMs(0),
+                           max_interval));
+  WriteGraph(kHeight - kGraphRows);
+
+  u32 width = std::min(buffer_.ScreenWidth(), fb_width);
+  u32 height = std::min(buffer_.ScreenHeight(), fb_height);
+
+  // Panes underneath may have redrawn over part of the HUD, and it is small
+  // enough to simply be drawn whole every frame.
+  renderer_.Invalidate();
+
+  frame.Damage(renderer_.RenderBuffer(
+      buffer_, Rect<u32>{fb_width - width, 0, fb_width, height}, fb_height));
+
+  stats.Current() = counters;
+}
+}  // namespace bitty
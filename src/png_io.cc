@@ -0,0 +1,69 @@
+#include "png_io.hh"
+
+#include <glad/gl.h>
+#include <png.h>
+
+#include <cstring>
+
+namespace bitty {
+RgbaImage ReadFramebuffer(u32 width, u32 height) {
+  RgbaImage image{width, height, std::vector<u8>(size_t(width) * height * 4)};
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+               image.pixels.data());
+
+  // GL returns the bottom row first
+  size_t stride = size_t(width) * 4;
+  std::vector<u8> row(stride);
+
+  for (u32 y = 0; y < height / 2; y++) {
+    u8 *top = image.pixels.data() + y * stride;
+    u8 *bottom = image.pixels.data() + (height - 1 - y) * stride;
+
+    std::memcpy(row.data(), top, stride);
+    std::memcpy(top, bottom, stride);
+    std::memcpy(bottom, row.data(), stride);
+  }
+
+  return image;
+}
+
+bool WritePng(const std::string &path, const RgbaImage &image) {
+  png_image png{};
+  png.version = PNG_IMAGE_VERSION;
+  png.width = image.width;
+  png.height = image.height;
+  png.format = PNG_FORMAT_RGBA;
+
+  if (!png_image_write_to_file(&png, path.c_str(), 0, image.pixels.data(), 0,
+                               nullptr)) {
+    LogError() << "Failed to write " << path << ": " << png.message << '\n';
+    return false;
+  }
+
+  return true;
+}
+
+std::optional<RgbaImage> ReadPng(const std::string &path) {
+  png_image png{};
+  png.version = PNG_IMAGE_VERSION;
+
+  if (!png_image_begin_read_from_file(&png, path.c_str())) {
+    LogError() << "Failed to read " << path << ": " << png.message << '\n';
+    return std::nullopt;
+  }
+
+  png.format = PNG_FORMAT_RGBA;
+
+  RgbaImage image{png.width, png.height,
+                  std::vector<u8>(PNG_IMAGE_SIZE(png))};
+
+  if (!png_image_finish_read(&png, nullptr, image.pixels.data(), 0, nullptr)) {
+    LogError() << "Failed to decode " << path << ": " << png.message << '\n';
+    return std::nullopt;
+  }
+
+  return image;
+}
+}  // namespace bitty
@@ -0,0 +1,149 @@
+#include "render_context.hh"
+
+#include <glad/gl.h>
+
+#include <cstddef>
+#include <utility>
+
+#include "config.hh"
+
+namespace bitty {
+bool RenderContext::SetupVertexArray() {
+  glGenVertexArrays(1, &vao_);
+
+  glBindVertexArray(vao_);
+
+  for (GLuint loc : {0u, 1u, 2u, 3u}) {
+    glEnableVertexAttribArray(loc);
+    glVertexAttribBinding(loc, kVertexBinding);
+  }
+
+  glVertexAttribIFormat(0, 2, GL_UNSIGNED_SHORT, offsetof(CellInstance, x));
+  glVertexAttribIFormat(1, 1, GL_UNSIGNED_INT, offsetof(CellInstance, glyph));
+  glVertexAttribFormat(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                       offsetof(CellInstance, foreground));
+  glVertexAttribFormat(3, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                       offsetof(CellInstance, background));
+
+  glVertexBindingDivisor(kVertexBinding, 1);
+
+  glGenVertexArrays(1, &empty_vao_);
+
+  bound_vao_ = vao_;
+
+  return true;
+}
+
+void RenderContext::BindVertexArray(GLuint vao) {
+  if (bound_vao_ == vao) return;
+
+  glBindVertexArray(vao);
+  bound_vao_ = vao;
+}
+
+void RenderContext::BindInstanceBuffer(GLuint buffer, GLintptr offset) {
+  BindVertexArray(vao_);
+
+  if (bound_instance_buffer_ == buffer && bound_instance_offset_ == offset)
+    return;
+
+  glBindVertexBuffer(kVertexBinding, buffer, offset, sizeof(CellInstance));
+  bound_instance_buffer_ = buffer;
+  bound_instance_offset_ = offset;
+}
+
+void RenderContext::BindFrameUniforms(GLuint buffer) {
+  if (bound_uniform_buffer_ == buffer) return;
+
+  // Also binds the generic GL_UNIFORM_BUFFER target used for updates
+  glBindBufferBase(GL_UNIFORM_BUFFER, kFrameUniformBinding, buffer);
+  bound_uniform_buffer_ = buffer;
+}
+
+void RenderContext::BindTexture(GLuint unit, GLuint texture) {
+  if (bound_textures_[unit] == texture) return;
+
+  SelectTexture(unit, texture);
+}
+
+void RenderContext::SelectTexture(GLuint unit, GLuint texture) {
+  if (active_texture_unit_ != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active_texture_unit_ = unit;
+  }
+
+  if (bound_textures_[unit] != texture) {
+    glBindTexture(kTextureTargets[unit], texture);
+    bound_textures_[unit] = texture;
+  }
+}
+
+void RenderContext::ForgetTexture(GLuint texture) {
+  // GL unbinds deleted textures, and the name may be handed out again
+  for (GLuint &bound : bound_textures_)
+    if (bound == texture) bound = 0;
+}
+
+void RenderContext::UploadAtlas() {
+  for (auto [unit, atlas] : {std::pair{0u, &charset_->CoverageAtlas()},
+                             std::pair{2u, &charset_->ColorAtlas()}}) {
+    GLuint texture = atlas->Texture();
+
+    // GlyphAtlas uploads to whatever is bound on the active unit
+    SelectTexture(unit, texture);
+    atlas->Upload();
+
+    // A grown atlas is a new texture, already bound by GlyphAtlas
+    if (atlas->Texture() != texture) {
+      ForgetTexture(texture);
+      bound_textures_[unit] = atlas->Texture();
+    }
+  }
+}
+
+void RenderContext::BindAtlas() {
+  BindTexture(0, charset_->CoverageAtlas().Texture());
+  BindTexture(2, charset_->ColorAtlas().Texture());
+}
+
+void RenderContext::ResetCharset() {
+  auto charset = std::make_unique<Charset>(32, 32);
+  charset->AdoptRasterizer(*charset_);
+
+  ForgetTexture(charset_->CoverageAtlas().Texture());
+  ForgetTexture(charset_->ColorAtlas().Texture());
+
+  charset_ = std::move(charset);
+  charset_generation_++;
+
+  // Cached runs hold glyph positions for the old size, and so do all the
+  // clusters interned until now
+  shaper_.Clear();
+  SweepGlyphClusters();
+}
+
+void RenderContext::SweepGlyphClusters() {
+  std::vector<bool> live;
+  shaper_.MarkGlyphClusters(live);
+  charset_->MarkGlyphClusters(live);
+  charset_->ForgetGlyphClusters(bitty::SweepGlyphClusters(live));
+}
+
+void RenderContext::ForgetBuffer(GLuint buffer) {
+  if (bound_uniform_buffer_ == buffer) bound_uniform_buffer_ = 0;
+  if (bound_instance_buffer_ == buffer) bound_instance_buffer_ = 0;
+}
+
+RenderContext::RenderContext()
+    : buf_program_(GLProgram::FromFiles("shaders/buf_vertex.glsl",
+                                        "shaders/buf_fragment.glsl")),
+      cursor_program_(GLProgram::FromFiles("shaders/cursor_vertex.glsl",
+                                           "shaders/cursor_fragment.glsl")),
+      grid_program_(GLProgram::FromFiles("shaders/grid_vertex.glsl",
+                                         "shaders/grid_fragment.glsl")),
+      charset_(std::make_unique<Charset>(32, 32)),
+      mode_(Config::Get().Renderer() == "grid" ? RendererMode::kGrid
+                                               : RendererMode::kInstanced) {
+  SetupVertexArray();
+}
+}  // namespace bitty
@@ -0,0 +1,99 @@
+#include "retained_frame.hh"
+
+#include <glad/gl.h>
+
+#include <algorithm>
+
+namespace bitty {
+namespace {
+Rect<u32> Union(Rect<u32> a, Rect<u32> b) {
+  if (!a.Width() || !a.Height()) return b;
+  if (!b.Width() || !b.Height()) return a;
+
+  return Rect<u32>{std::min(a.left, b.left), std::min(a.top, b.top),
+                   std::max(a.right, b.right), std::max(a.bottom, b.bottom)};
+}
+}  // namespace
+
+RetainedFrame::~RetainedFrame() { Release(); }
+
+void RetainedFrame::Release() {
+  if (framebuffer_) glDeleteFramebuffers(1, &framebuffer_);
+  if (color_) glDeleteRenderbuffers(1, &color_);
+
+  framebuffer_ = color_ = 0;
+}
+
+bool RetainedFrame::Resize(u32 width, u32 height) {
+  if (framebuffer_ && width == width_ && height == height_) return false;
+
+  Release();
+
+  width_ = width;
+  height_ = height;
+
+  glGenRenderbuffers(1, &color_);
+  glBindRenderbuffer(GL_RENDERBUFFER, color_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+  glGenFramebuffers(1, &framebuffer_);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color_);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    LogError() << "Retained framebuffer is incomplete\n";
+
+  // Nothing in the back buffers is usable any more
+  history_frames_ = 0;
+  DamageAll();
+
+  return true;
+}
+
+void RetainedFrame::Bind() {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+}
+
+void RetainedFrame::Damage(Rect<u32> area) {
+  area.Clamp(Rect<u32>{0, 0, width_, height_});
+
+  if (area.IsValid()) damage_ = Union(damage_, area);
+}
+
+bool RetainedFrame::Present(u32 buffer_age) {
+  // An unchanged frame needs no swap, and without one no back buffer ages.
+  if (!HasDamage()) return false;
+
+  Rect<u32> current = damage_;
+  Rect<u32> copy = current;
+
+  // A back buffer of age n has missed the damage of the last n - 1 frames.
+  // Anything older than the history, or of unknown age, gets a full copy.
+  if (buffer_age == 0 || buffer_age > history_frames_ + 1 ||
+      buffer_age > kHistorySize + 1)
+    copy = Rect<u32>{0, 0, width_, height_};
+  else
+    for (u32 i = 0; i + 1 < buffer_age; i++) copy = Union(copy, history_[i]);
+
+  for (u32 i = kHistorySize - 1; i > 0; i--) history_[i] = history_[i - 1];
+
+  history_[0] = current;
+  history_frames_ = std::min(history_frames_ + 1, kHistorySize);
+  damage_ = Rect<u32>{};
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+  // GL window coordinates start at the bottom left
+  GLint x0 = copy.left, y0 = height_ - copy.bottom;
+  GLint x1 = copy.right, y1 = height_ - copy.top;
+
+  glBlitFramebuffer(x0, y0, x1, y1, x0, y0, x1, y1, GL_COLOR_BUFFER_BIT,
+                    GL_NEAREST);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  return true;
+}
+}  // namespace bitty
@@ -0,0 +1,267 @@
+#include "shaper.hh"
+
+#include <algorithm>
+#include <mutex>
+
+#include "box_drawing.hh"
+#include "config.hh"
+
+namespace bitty {
+namespace {
+struct GlyphClusterHash {
+  inline size_t operator()(const GlyphCluster &cluster) const {
+    size_t result = 0;
+    boost::hash_combine(result, cluster.bold);
+    boost::hash_combine(result, cluster.cells);
+
+    for (const auto &glyph : cluster.glyphs) {
+      boost::hash_combine(result, glyph.glyph);
+      boost::hash_combine(result, glyph.x);
+      boost::hash_combine(result, glyph.y);
+    }
+
+    return result;
+  }
+};
+
+// Below this many clusters the table is not worth sweeping
+constexpr size_t kMinSweepSize = 4096;
+
+std::mutex clusters_mutex;
+std::unordered_map<GlyphCluster, u32, GlyphClusterHash> cluster_ids;
+// No cells wide where the id was freed
+std::vector<GlyphCluster> clusters;
+std::vector<u32> free_ids;
+size_t swept_size = 0;  // Clusters left by the last sweep
+}  // namespace
+
+u32 InternGlyphCluster(const GlyphCluster &cluster) {
+  std::unique_lock lock{clusters_mutex};
+
+  if (auto it = cluster_ids.find(cluster); it != cluster_ids.end())
+    return it->second;
+
+  u32 id;
+
+  if (!free_ids.empty()) {
+    id = free_ids.back();
+    free_ids.pop_back();
+    clusters[id - 1] = cluster;
+  } else {
+    clusters.push_back(cluster);
+    id = clusters.size();
+  }
+
+  cluster_ids.emplace(cluster, id);
+
+  return id;
+}
+
+std::optional<GlyphCluster> FindGlyphCluster(u32 id) {
+  std::unique_lock lock{clusters_mutex};
+
+  if (id == 0 || id > clusters.size() || clusters[id - 1].cells == 0)
+    return std::nullopt;
+
+  return clusters[id - 1];
+}
+
+bool GlyphClusterSweepDue() {
+  std::unique_lock lock{clusters_mutex};
+
+  return cluster_ids.size() >= std::max(kMinSweepSize, 2 * swept_size);
+}
+
+std::vector<u32> SweepGlyphClusters(const std::vector<bool> &live) {
+  std::unique_lock lock{clusters_mutex};
+
+  std::vector<u32> freed;
+
+  for (u32 id = 1; id <= clusters.size(); id++) {
+    GlyphCluster &cluster = clusters[id - 1];
+    if ((id < live.size() && live[id]) || cluster.cells == 0) continue;
+
+    cluster_ids.erase(cluster);
+    cluster = {};
+    free_ids.push_back(id);
+    freed.push_back(id);
+  }
+
+  swept_size = cluster_ids.size();
+
+  return freed;
+}
+
+std::vector<bool> ChangedCharacters(
+    const std::u32string &text, const std::vector<ShapedGlyph> &glyphs,
+    const std::function<u32(char32_t)> &nominal_glyph) {
+  std::vector<bool> changed(text.size());
+  bool any_changed = false;
+
+  for (size_t k = 0; k < glyphs.size();) {
+    u32 first = glyphs[k].cluster;
+    size_t next = k;
+
+    while (next < glyphs.size() && glyphs[next].cluster == first) next++;
+
+    u32 end = next < glyphs.size() ? glyphs[next].cluster : text.size();
+
+    // Right to left text is not drawn by cell anyway
+    if (end <= first) return {};
+
+    // A character per glyph, each the font's own and not moved. Advances are
+    // not compared: unhinted ones are fractional, and cells are drawn on the
+    // grid regardless
+    bool plain = next - k == end - first;
+
+    for (size_t i = 0; plain && i < next - k; i++) {
+      const ShapedGlyph &glyph = glyphs[k + i];
+
+      plain = glyph.glyph == nominal_glyph(text[first + i]) &&
+              glyph.x_offset == 0 && glyph.y_offset == 0;
+    }
+
+    if (!plain) {
+      for (u32 i = first; i < end; i++) changed[i] = true;
+      any_changed = true;
+    }
+
+    k = next;
+  }
+
+  return any_changed ? changed : std::vector<bool>{};
+}
+
+Shaper::Shaper() : enabled_(Config::Get().Ligatures()) {}
+
+void Shaper::MarkGlyphClusters(std::vector<bool> &live) const {
+  for (const auto &[key, segments] : runs_) {
+    for (Segment segment : segments) {
+      if (!segment.cluster) continue;
+
+      if (segment.cluster >= live.size()) live.resize(segment.cluster + 1);
+      live[segment.cluster] = true;
+    }
+  }
+}
+
+std::vector<Shaper::Segment> Shaper::ShapeRun(const std::u32string &text,
+                                              u16 style) {
+  auto &fonts = FontRenderer::Get();
+  bool bold = style & CellFlags::kBold;
+
+  fonts.Shape(text, bold, glyphs_);
+
+  std::vector<bool> changed =
+      ChangedCharacters(text, glyphs_, [&](char32_t codepoint) {
+        return fonts.NominalGlyph(codepoint, bold);
+      });
+
+  if (changed.empty()) return {};
+
+  i32 advance = fonts.CellWidthPx() * 64;
+
+  std::vector<Segment> segments(text.size(), Segment{0, 0, 0});
+
+  size_t k = 0;
+
+  for (u32 first = 0; first < text.size();) {
+    if (!changed[first]) {
+      while (k < glyphs_.size() && glyphs_[k].cluster == first) k++;
+
+      first++;
+      continue;
+    }
+
+    u32 end = first;
+    while (end < text.size() && changed[end]) end++;
+
+    GlyphCluster cluster{.bold = bold, .cells = u16(end - first), .glyphs = {}};
+    u32 current = end;
+    i32 pen = 0;
+
+    for (; k < glyphs_.size() && glyphs_[k].cluster < end; k++) {
+      const ShapedGlyph &glyph = glyphs_[k];
+
+      // Each of HarfBuzz's clusters starts at the origin of its first cell,
+      // so fractional advances cannot drift off the grid
+      if (glyph.cluster != current) {
+        current = glyph.cluster;
+        pen = (current - first) * advance;
+      }
+
+      cluster.glyphs.push_back(GlyphCluster::Glyph{
+          glyph.glyph, pen + glyph.x_offset, glyph.y_offset});
+      pen += glyph.x_advance;
+    }
+
+    u32 id = InternGlyphCluster(cluster);
+
+    for (u32 i = first; i < end; i++)
+      segments[i] = Segment{id, u16(i - first), u16(end - first)};
+
+    first = end;
+  }
+
+  return segments;
+}
+
+void Shaper::ShapeRow(ColoredCell *cells, size_t count) {
+  if (!enabled_) return;
+
+  auto &fonts = FontRenderer::Get();
+
+  for (size_t start = 0; start < count;) {
+    u16 style = cells[start].flags & kStyleFlags;
+    bool bold = style & CellFlags::kBold;
+
+    // Runs are plain characters the face has, wide ones and those from
+    // fallback fonts split them
+    auto shapeable = [&](const ColoredCell &cell) {
+      return cell.displayed_code && cell.segment_count == 1 &&
+             !(cell.flags & CellFlags::kGrapheme) &&
+             !IsBoxDrawing(cell.displayed_code) &&
+             (cell.flags & kStyleFlags) == style &&
+             fonts.NominalGlyph(cell.displayed_code, bold);
+    };
+
+    if (!shapeable(cells[start]) || !fonts.HasSubstitutions(bold)) {
+      start++;
+      continue;
+    }
+
+    size_t end = start + 1;
+    while (end < count && shapeable(cells[end])) end++;
+
+    if (end - start >= 2) {
+      text_.clear();
+
+      for (size_t i = start; i < end; i++) text_ += cells[i].displayed_code;
+
+      auto found = runs_.find(RunKey{text_, style});
+
+      if (found == runs_.end()) {
+        if (runs_.size() >= kMaxCachedRuns) runs_.clear();
+
+        found = runs_.emplace(RunKey{text_, style}, ShapeRun(text_, style))
+                    .first;
+      }
+
+      const std::vector<Segment> &segments = found->second;
+
+      for (size_t i = 0; i < segments.size(); i++) {
+        if (!segments[i].cluster) continue;
+
+        ColoredCell &cell = cells[start + i];
+
+        cell.displayed_code = segments[i].cluster;
+        cell.flags = CellFlags(cell.flags | CellFlags::kShaped);
+        cell.segment_index = segments[i].index;
+        cell.segment_count = segments[i].count;
+      }
+    }
+
+    start = end;
+  }
+}
+}  // namespace bitty
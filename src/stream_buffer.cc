@@ -0,0 +1,159 @@
+#include "stream_buffer.hh"
+
+#include <glad/gl.h>
+
+#include <cstring>
+
+#include "util.hh"
+
+namespace bitty {
+StreamingBuffer::StreamingBuffer(GLenum target) : target_(target) {
+  persistent_ = GLAD_GL_VERSION_4_4;
+  region_count_ = persistent_ ? kRegionCount : 1;
+}
+
+StreamingBuffer::~StreamingBuffer() { Release(); }
+
+void StreamingBuffer::Release() {
+  for (auto &fence : fences_) {
+    if (fence) glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  if (buffer_) {
+    if (mapped_) {
+      glBindBuffer(target_, buffer_);
+      glUnmapBuffer(target_);
+    }
+
+    glDeleteBuffers(1, &buffer_);
+  }
+
+  buffer_ = 0;
+  mapped_ = nullptr;
+}
+
+void StreamingBuffer::Resize(u32 rows, size_t row_size) {
+  Release();
+
+  rows_ = rows;
+  row_size_ = row_size;
+  region_size_ = rows * row_size;
+  current_ = 0;
+
+  glGenBuffers(1, &buffer_);
+  glBindBuffer(target_, buffer_);
+
+  GLsizeiptr total_size = region_size_ * region_count_;
+
+  if (persistent_) {
+    constexpr GLbitfield kFlags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glBufferStorage(target_, total_size, nullptr, kFlags);
+    mapped_ = (std::byte *)glMapBufferRange(target_, 0, total_size, kFlags);
+
+    if (!mapped_) {
+      LogWarning() << "Persistent buffer mapping failed, falling back to "
+                      "glBufferSubData\n";
+
+      glDeleteBuffers(1, &buffer_);
+      buffer_ = 0;
+      persistent_ = false;
+      region_count_ = 1;
+
+      Resize(rows, row_size);
+      return;
+    }
+  } else
+    glBufferData(target_, total_size, nullptr, GL_DYNAMIC_DRAW);
+
+  for (u32 i = 0; i < region_count_; i++)
+    stale_rows_[i] = boost::dynamic_bitset<>(rows);
+
+  MarkAllDirty();
+}
+
+void StreamingBuffer::MarkRowsDirty(const boost::dynamic_bitset<> &rows) {
+  for (u32 i = 0; i < region_count_; i++)
+    if (rows.size() == stale_rows_[i].size()) stale_rows_[i] |= rows;
+}
+
+void StreamingBuffer::MarkAllDirty() {
+  for (u32 i = 0; i < region_count_; i++) stale_rows_[i].set();
+}
+
+void StreamingBuffer::WaitForRegion(u32 region) {
+  GLsync &fence = fences_[region];
+
+  if (!fence) return;
+
+  GLbitfield flags = 0;
+
+  for (;;) {
+    GLenum status = glClientWaitSync(fence, flags, 1'000'000'000);
+
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED ||
+        status == GL_WAIT_FAILED)
+      break;
+
+    flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  }
+
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+size_t StreamingBuffer::Upload(const void *source) {
+  last_upload_bytes_ = 0;
+
+  if (!buffer_) return 0;
+
+  // The current region is up to date, so keep drawing from it rather than
+  // moving on to one that may still be read by the GPU.
+  if (stale_rows_[current_].none()) return 0;
+
+  current_ = (current_ + 1) % region_count_;
+
+  auto &stale = stale_rows_[current_];
+
+  if (stale.none()) return 0;
+
+  if (persistent_) WaitForRegion(current_);
+
+  glBindBuffer(target_, buffer_);
+
+  auto *src = (const std::byte *)source;
+
+  // Coalesce consecutive stale rows into a single copy.
+  for (size_t first = stale.find_first(); first != stale.npos;) {
+    size_t last = first;
+
+    while (last + 1 < stale.size() && stale[last + 1]) last++;
+
+    size_t offset = first * row_size_;
+    size_t size = (last - first + 1) * row_size_;
+
+    if (persistent_)
+      std::memcpy(mapped_ + Offset() + offset, src + offset, size);
+    else
+      glBufferSubData(target_, offset, size, src + offset);
+
+    last_upload_bytes_ += size;
+
+    first = stale.find_next(last);
+  }
+
+  stale.reset();
+
+  return last_upload_bytes_;
+}
+
+void StreamingBuffer::Fence() {
+  if (!persistent_) return;
+
+  if (fences_[current_]) glDeleteSync(fences_[current_]);
+
+  fences_[current_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+}  // namespace bitty
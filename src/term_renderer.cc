@@ -2,184 +2,440 @@
 
 #include <glad/gl.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <glm/ext.hpp>
-#include <glm/ext/matrix_float3x2.hpp>
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/ext/vector_float3.hpp>
-#include <glm/mat3x2.hpp>
 
 #include "cell_buffer.hh"
 #include "font_renderer.hh"
+#include "frame_stats.hh"
 #include "terminal.hh"
 #include "util.hh"
 
 namespace bitty {
-bool TermRenderer::SetupGLBuffers() {
-  glGenBuffers(1, &vbo_);
+TermRenderer::TermRenderer(RenderContext &context)
+    : context_(context), instance_buffer_(GL_ARRAY_BUFFER) {
+  glGenBuffers(1, &frame_buffer_);
 
-  glGenBuffers(1, &ibo_);
+  context_.BindFrameUniforms(frame_buffer_);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr,
+               GL_DYNAMIC_DRAW);
+}
+
+TermRenderer::~TermRenderer() {
+  context_.ForgetBuffer(frame_buffer_);
+  context_.ForgetBuffer(instance_buffer_.Id());
+  glDeleteBuffers(1, &frame_buffer_);
+
+  if (grid_texture_) {
+    context_.ForgetTexture(grid_texture_);
+    glDeleteTextures(1, &grid_texture_);
+  }
+}
+
+void TermRenderer::ResizeGrid(u32 width, u32 ring_rows) {
+  grid_width_ = width;
+  ring_rows_ = ring_rows;
+
+  instances_ = std::vector<CellInstance>(width * ring_rows);
+  slot_rows_ = std::vector<i64>(ring_rows, kNoRow);
+  dirty_rows_ = boost::dynamic_bitset<>(ring_rows);
+  pending_rows_ = boost::dynamic_bitset<>(ring_rows);
+  damaged_rows_ = boost::dynamic_bitset<>(ring_rows);
+  full_damage_ = true;
+
+  if (context_.Mode() == RendererMode::kGrid) {
+    // Immutable storage cannot be resized, so start over with a new texture.
+    if (grid_texture_) {
+      context_.ForgetTexture(grid_texture_);
+      glDeleteTextures(1, &grid_texture_);
+    }
+
+    glGenTextures(1, &grid_texture_);
+    context_.SelectTexture(1, grid_texture_);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, width, ring_rows);
+
+    // Integer textures are incomplete with linear filtering
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    dirty_rows_.set();
+  } else {
+    context_.ForgetBuffer(instance_buffer_.Id());
+    instance_buffer_.Resize(ring_rows, width * sizeof(CellInstance));
+  }
+}
+
+void TermRenderer::TouchResidentRows() {
+  Charset &charset = context_.GetCharset();
+
+  // Nothing in the ring maps to the slots of a new charset
+  if (context_.CharsetGeneration() != charset_generation_) {
+    std::fill(slot_rows_.begin(), slot_rows_.end(), kNoRow);
+    pending_rows_.reset();
+    atlas_evictions_ = charset.Evictions();
+    atlas_arrivals_ = charset.Arrivals();
+    charset_generation_ = context_.CharsetGeneration();
+    touched_round_ = 0;
+  }
+
+  if (touched_round_ == charset.Round()) return;
 
-  glGenVertexArrays(1, &vao_);
+  touched_round_ = charset.Round();
 
-  glBindVertexArray(vao_);
+  // Slots evicted since the rows were loaded may hold other glyphs by now
+  if (charset.Evictions() != atlas_evictions_) {
+    std::fill(slot_rows_.begin(), slot_rows_.end(), kNoRow);
+    atlas_evictions_ = charset.Evictions();
+    return;
+  }
+
+  for (u32 slot = 0; slot < ring_rows_; slot++) {
+    if (slot_rows_[slot] == kNoRow) continue;
+
+    const CellInstance *row = instances_.data() + slot * grid_width_;
+
+    for (u32 x = 0; x < grid_width_; x++)
+      charset.Touch(row[x].glyph & CellInstance::kSlotMask);
+  }
+}
 
-  pos_loc_ = 0;
-  uv_loc_ = 1;
-  fore_loc_ = 2;
-  back_loc_ = 3;
+void TermRenderer::LoadRow(const CellBuffer &buf, u32 row) {
+  Charset &charset = context_.GetCharset();
 
-  glEnableVertexAttribArray(pos_loc_);
+  u32 slot = row % ring_rows_;
+  CellInstance *dest = instances_.data() + slot * grid_width_;
 
-  glEnableVertexAttribArray(uv_loc_);
+  // Rows past the end of the buffer are cleared rather than left stale, as
+  // they can still peek out below the grid.
+  const ColoredCell *src = row < buf.Height() ? buf.RowData(row) : nullptr;
+  bool pending = false;
 
-  glEnableVertexAttribArray(fore_loc_);
+  row_cells_.assign(grid_width_, ColoredCell{});
+  if (src) std::copy(src, src + grid_width_, row_cells_.begin());
 
-  glEnableVertexAttribArray(back_loc_);
+  context_.GetShaper().ShapeRow(row_cells_.data(), row_cells_.size());
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  for (u32 x = 0; x < grid_width_; x++) {
+    const ColoredCell &chr = row_cells_[x];
 
-  float *ptr = nullptr;
+    u32 glyph =
+        chr.displayed_code ? charset.MapCharacter(chr) : Charset::kInvalidSlot;
 
-  for (const auto [loc, size] :
-       {std::tuple{pos_loc_, 4}, std::tuple{uv_loc_, 2},
-        std::tuple{fore_loc_, 4}, std::tuple{back_loc_, 4}}) {
-    glVertexAttribPointer(loc, size, GL_FLOAT, GL_FALSE,
-                          sizeof(VertexBufElement), ptr);
+    // Drawn blank for now, and reloaded once the glyph has arrived
+    if (glyph == Charset::kInvalidSlot && chr.displayed_code)
+      pending = pending || charset.IsPending(chr);
 
-    ptr += size;
+    dest[x] = CellInstance(x, slot, glyph, chr);
   }
 
+  slot_rows_[slot] = row;
+  dirty_rows_[slot] = true;
+  pending_rows_[slot] = pending;
+
+  FrameStats::Get().Current().cells_updated += grid_width_;
+}
+
+bool TermRenderer::UpdateFrameUniforms(const FrameUniforms &frame) {
+  context_.BindFrameUniforms(frame_buffer_);
+
+  if (frame_valid_ && std::memcmp(&frame, &frame_, sizeof(frame)) == 0)
+    return false;
+
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+
+  frame_ = frame;
+  frame_valid_ = true;
+
   return true;
 }
 
-TermRenderer::TermRenderer()
-    : buf_program_(GLProgram::FromFiles("shaders/buf_vertex.glsl",
-                                        "shaders/buf_fragment.glsl")),
-      cursor_program_(GLProgram::FromFiles("shaders/cursor_vertex.glsl",
-                                           "shaders/cursor_fragment.glsl")),
-      charset_(128, 128) {
-  SetupGLBuffers();
+void TermRenderer::UploadRows() {
+  last_upload_bytes_ = 0;
+
+  if (context_.Mode() != RendererMode::kGrid) {
+    instance_buffer_.MarkRowsDirty(dirty_rows_);
+    dirty_rows_.reset();
+
+    last_upload_bytes_ = instance_buffer_.Upload(instances_.data());
+    return;
+  }
+
+  if (dirty_rows_.any()) context_.SelectTexture(1, grid_texture_);
+
+  // One texel per cell, so a damaged row range is one sub-image upload.
+  for (size_t first = dirty_rows_.find_first(); first != dirty_rows_.npos;) {
+    size_t last = first;
+
+    while (last + 1 < dirty_rows_.size() && dirty_rows_[last + 1]) last++;
+
+    u32 rows = last - first + 1;
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, grid_width_, rows,
+                    GL_RGBA_INTEGER, GL_UNSIGNED_INT,
+                    instances_.data() + first * grid_width_);
+
+    last_upload_bytes_ += rows * grid_width_ * sizeof(CellInstance);
+
+    first = dirty_rows_.find_next(last);
+  }
+
+  dirty_rows_.reset();
 }
 
-bool TermRenderer::Render(Terminal &term, u32 window_width, u32 window_height) {
-  auto ch_w = GlobalCellWidthPx();
-  auto ch_h = GlobalCellHeightPx();
+void TermRenderer::DrawCells() {
+  context_.BindAtlas();
 
+  if (context_.Mode() == RendererMode::kGrid) {
+    context_.GridProgram().Use();
+    context_.BindTexture(1, grid_texture_);
+    context_.BindVertexArray(context_.EmptyVertexArray());
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  } else {
+    context_.BindInstanceBuffer(instance_buffer_.Id(),
+                                instance_buffer_.Offset());
+    context_.BufProgram().Use();
+
+    // The instance buffer covers the whole grid, so drawing any part of the
+    // screen is a single draw call clipped by the scissor box.
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances_.size());
+  }
+}
+
+std::optional<CursorQuad> TermRenderer::BuildCursor(Terminal &term,
+                                                    const CellBuffer &buf) {
+  auto cell = buf.Get(term.CursorX(), term.CursorY());
+  if (!cell.has_value()) return std::nullopt;
+
+  ColoredCell chr =
+      cell->displayed_code ? cell.value() : term.GetDefaultEmptyCell();
+
+  u32 cell_width = GlobalCellWidthPx(), cell_height = GlobalCellHeightPx();
+
+  CursorQuad cursor{
+      .pos = glm::vec2(term.CursorX() * cell_width,
+                       i64(buf.ScrollInCells() + term.CursorY()) * cell_height -
+                           i64(buf.UserScrollInPixels())),
+      .size = glm::vec2(cell_width, cell_height),
+      .glyph = Charset::kInvalidSlot,
+      .foreground = chr.foreground,
+      .background = chr.background};
+
+  switch (term.GetCursorStyle()) {
+    case CursorStyle::kBlock:
+      // Same look as the cell with its colors swapped
+      cursor.glyph = context_.GetCharset().MapCharacter(chr);
+      std::swap(cursor.foreground, cursor.background);
+      break;
+    case CursorStyle::kUnderline:
+      cursor.size.y = std::max(1u, cell_height / 10);
+      cursor.pos.y += cell_height - cursor.size.y;
+      cursor.background = cursor.foreground;
+      break;
+    case CursorStyle::kBar:
+      cursor.size.x = std::max(1u, cell_width / 8);
+      cursor.background = cursor.foreground;
+      break;
+  }
+
+  return cursor;
+}
+
+void TermRenderer::DrawCursor(const CursorQuad &cursor) {
+  GLProgram &cursor_program = context_.CursorProgram();
+
+  cursor_program.Use();
+  cursor_program.SetUniform("cursor_pos", cursor.pos);
+  cursor_program.SetUniform("cursor_size", cursor.size);
+  cursor_program.SetUniform<GLuint>("glyph", cursor.glyph);
+  cursor_program.SetUniform<GLuint>("foreground", cursor.foreground.raw);
+  cursor_program.SetUniform<GLuint>("background", cursor.background.raw);
+
+  context_.BindAtlas();
+  context_.BindVertexArray(context_.EmptyVertexArray());
+
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void TermRenderer::DamagePixelRows(float top, float bottom) {
+  i64 cell_height = GlobalCellHeightPx();
+  i64 first = i64(std::floor(top)) + frame_.scroll_offset;
+  i64 last = i64(std::ceil(bottom)) - 1 + frame_.scroll_offset;
+
+  first = std::clamp<i64>(first / cell_height, 0, ring_rows_ - 1);
+  last = std::clamp<i64>(last / cell_height, 0, ring_rows_ - 1);
+
+  if (first <= last) damaged_rows_.set(first, last - first + 1, true);
+}
+
+Rect<u32> TermRenderer::Render(Terminal &term, Rect<u32> area, u32 fb_height,
+                               bool cursor_blink_on) {
   std::shared_ptr<CellBuffer> buf = term.CurrentBuffer();
 
-  size_t w = buf->Width(), h = buf->VisibleHeight();
-  size_t buf_wh = w * h;
+  // The cursor is its own pass so that moving or blinking it leaves the
+  // cell buffer and the uploaded rows untouched.
+  bool show_cursor = term.IsCursorVisible() && !buf->UserScrolledUp() &&
+                     (cursor_blink_on || !term.IsCursorBlinking());
 
-  ibo_data_ = std::vector<u32>();
-  ibo_data_.reserve(buf_wh * 6);
+  return RenderBuffer(*buf, area, fb_height,
+                      show_cursor ? BuildCursor(term, *buf) : std::nullopt);
+}
 
-  if (vbo_data_.size() < buf_wh * 4)
-    vbo_data_ = std::vector<VertexBufElement>(buf_wh * 4);
+Rect<u32> TermRenderer::RenderBuffer(CellBuffer &buf, Rect<u32> area,
+                                     u32 fb_height,
+                                     const std::optional<CursorQuad> &cursor) {
+  Charset &charset = context_.GetCharset();
 
-  glm::dvec2 window_size(window_width, window_height);
+  // One spare row so that a view scrolled by a fraction of a cell still has
+  // both partially visible rows resident.
+  u32 w = buf.Width(), ring_rows = buf.VisibleHeight() + 1;
 
-  auto id = glm::dmat4(1);
+  // Ring rows are keyed by buffer row, so switching to the alternate screen
+  // invalidates all of them.
+  if (w != grid_width_ || ring_rows != ring_rows_ || &buf != ring_source_)
+    ResizeGrid(w, ring_rows);
 
-  glm::dmat4 xy_to_normalized = glm::scale(id, glm::dvec3(1, -1, 1)) *
-                                glm::translate(id, glm::dvec3(-1, -1, 0)) *
-                                glm::scale(id, glm::dvec3(2. / window_size, 1));
+  ring_source_ = &buf;
 
-  auto wh =
-      glm::vec2(charset_.TexWidthInPixels(), charset_.TexHeightInPixels());
+  TouchResidentRows();
 
-  auto opacity_vec = glm::vec4(1, 1, 1, bitty::Config::Get().Opacity());
+  if (area != area_) {
+    area_ = area;
 
-  ColoredCell org_cell_at_cursor{};
-  bool cursor_was_displayed = false;
+    glm::dvec2 window_size(area.Width(), area.Height());
 
-  bool show_cursor = term.IsCursorVisible() && !buf->UserScrolledUp();
+    auto id = glm::dmat4(1);
 
-  if (show_cursor) {
-    if (auto cell_at_curs = buf->Get(term.CursorX(), term.CursorY());
-        cell_at_curs.has_value()) {
-      org_cell_at_cursor = cell_at_curs.value();
+    xy_to_normalized_ =
+        glm::mat4(glm::scale(id, glm::dvec3(1, -1, 1)) *
+                  glm::translate(id, glm::dvec3(-1, -1, 0)) *
+                  glm::scale(id, glm::dvec3(2. / window_size, 1)));
 
-      buf->Set(term.CursorX(), term.CursorY(), org_cell_at_cursor.SwapColors());
-      cursor_was_displayed = true;
-    }
+    full_damage_ = true;
   }
 
-  auto add_char_to_buffer = [&](u32 x, u32 y, ColoredCell chr) mutable -> bool {
-    TexRegion<u32> region = charset_.MapCharacter(chr);
+  // Modified rows are only dropped from the ring here; whichever of them are
+  // in view get reloaded below together with rows exposed by scrolling.
+  buf.ProcessUpdates([&](u32 row) {
+    if (i64 &resident = slot_rows_[row % ring_rows_]; resident == row)
+      resident = kNoRow;
+  });
 
-    auto tl = glm::vec2(region.top_left);
-    auto br = glm::vec2(region.bottom_right);
+  // Rows drawn without glyphs that have since been rasterized
+  charset.CommitRasterized();
 
-    auto tl_gl = tl / wh;
-    auto br_gl = br / wh;
+  if (charset.Arrivals() != atlas_arrivals_) {
+    for (size_t slot = pending_rows_.find_first(); slot != pending_rows_.npos;
+         slot = pending_rows_.find_next(slot))
+      slot_rows_[slot] = kNoRow;
 
-    auto tr_gl = glm::vec2(br_gl.x, tl_gl.y);
-    auto bl_gl = glm::vec2(tl_gl.x, br_gl.y);
+    pending_rows_.reset();
+    atlas_arrivals_ = charset.Arrivals();
+  }
 
-    auto sx = x * ch_w;
-    auto sy = y * ch_h;
+  u32 cell_height = GlobalCellHeightPx();
+  u32 top_row = buf.UserScrollInPixels() / cell_height;
 
-    u32 vert_base = 4 * (x + y * w);
+  for (u32 row = top_row; row < top_row + ring_rows_; row++) {
+    if (slot_rows_[row % ring_rows_] == row) continue;
 
-    for (const auto [i, xy, uv] : {
-             std::tuple{0, glm::vec2(sx, sy), tl_gl},
-             {1, glm::vec2(sx, sy + ch_h), bl_gl},
-             {2, glm::vec2(sx + ch_w, sy + ch_h), br_gl},
-             {3, glm::vec2(sx + ch_w, sy), tr_gl},
-         }) {
-      auto vertex_pos = xy_to_normalized * glm::dvec4(xy, 0.0, 1.0);
+    LoadRow(buf, row);
+    damaged_rows_[row - top_row] = true;
+  }
 
-      bool is_default_bg_color = chr.background.r == 0 &&
-                                 chr.background.g == 0 && chr.background.b == 0;
+  // Whatever was evicted while loading was not in use in this round, so
+  // neither in the resident rows nor in those just loaded
+  atlas_evictions_ = charset.Evictions();
 
-      vbo_data_[i + vert_base] = VertexBufElement{
-          .position = (glm::vec4)vertex_pos,
-          .uv = uv,
-          .foreground = chr.foreground.AsVec4(),
-          .background = chr.background.AsVec4() *
-                        (is_default_bg_color ? opacity_vec : glm::vec4(1))};
-    }
+  context_.UploadAtlas();
 
-    return true;
-  };
+  FrameUniforms frame{};
+  frame.transform = xy_to_normalized_ * glm::mat4(buf.GetTransform());
+  frame.viewport_size = glm::ivec2(area.Width(), area.Height());
+  frame.cell_size = glm::ivec2(GlobalCellWidthPx(), cell_height);
+  frame.opacity = Config::Get().Opacity();
+  frame.ring_rows = ring_rows_;
+  frame.row_offset = top_row % ring_rows_;
+  frame.scroll_offset = buf.UserScrollInPixels() % cell_height;
 
-  buf->ProcessUpdates(add_char_to_buffer);
-  buf->EnumerateNonEmptyCells([&](u32 idx) -> bool {
-    idx *= 4;
+  // Scrolling, resizing or a new opacity move or recolor every pixel
+  if (UpdateFrameUniforms(frame)) full_damage_ = true;
 
-    ibo_data_.insert(ibo_data_.end(),
-                     {idx + 0, idx + 1, idx + 3, idx + 1, idx + 2, idx + 3});
+  if (cursor != last_cursor_) {
+    if (last_cursor_)
+      DamagePixelRows(last_cursor_->pos.y,
+                      last_cursor_->pos.y + last_cursor_->size.y);
 
-    return true;
-  });
+    if (cursor) DamagePixelRows(cursor->pos.y, cursor->pos.y + cursor->size.y);
 
-  if (cursor_was_displayed)
-    buf->Set(term.CursorX(), term.CursorY(), org_cell_at_cursor);
+    last_cursor_ = cursor;
+  }
 
-  charset_.UploadToGL();
+  if (full_damage_) damaged_rows_.set();
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+  UploadRows();
+  FrameStats::Get().Current().vertex_bytes += last_upload_bytes_;
 
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, ibo_data_.size() * sizeof(u32),
-               ibo_data_.data(), GL_DYNAMIC_DRAW);
+  if (damaged_rows_.none()) return Rect<u32>{};
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glViewport(area.left, fb_height - area.bottom, area.Width(), area.Height());
+  glEnable(GL_SCISSOR_TEST);
 
-  glBufferData(GL_ARRAY_BUFFER, vbo_data_.size() * sizeof(VertexBufElement),
-               vbo_data_.data(), GL_DYNAMIC_DRAW);
+  Rect<u32> damage{};
 
-  buf_program_.Use();
-  buf_program_.SetUniform("transform",
-                          glm::mat4(xy_to_normalized * buf->GetTransform() *
-                                    glm::inverse(xy_to_normalized)));
+  if (full_damage_) {
+    // Also covers the strips right of and below the grid
+    glScissor(area.left, fb_height - area.bottom, area.Width(), area.Height());
+    glClearColor(0, 0, 0, frame.opacity);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-  buf_program_.SetUniform<GLint>("cell_width", ch_w);
+    damage = Rect<u32>{0, 0, area.Width(), area.Height()};
+  }
 
-  glBindTexture(GL_TEXTURE_2D, charset_.GetGLTexture());
-  glBindVertexArray(vao_);
+  // Only the damaged rows are filled, one scissored draw per run of them.
+  for (size_t first = damaged_rows_.find_first();
+       first != damaged_rows_.npos;) {
+    size_t last = first;
 
-  glDrawElements(GL_TRIANGLES, ibo_data_.size(), GL_UNSIGNED_INT, 0);
+    while (last + 1 < damaged_rows_.size() && damaged_rows_[last + 1]) last++;
 
-  return true;
+    i64 top = std::clamp<i64>(i64(first * cell_height) - frame.scroll_offset,
+                              0, area.Height());
+    i64 bottom = std::clamp<i64>(
+        i64((last + 1) * cell_height) - frame.scroll_offset, 0, area.Height());
+
+    first = damaged_rows_.find_next(last);
+
+    if (top >= bottom) continue;
+
+    glScissor(area.left, fb_height - area.top - bottom, area.Width(),
+              bottom - top);
+
+    DrawCells();
+
+    if (cursor && cursor->pos.y < bottom &&
+        cursor->pos.y + cursor->size.y > top)
+      DrawCursor(*cursor);
+
+    if (damage.Height() == 0)
+      damage = Rect<u32>{0, u32(top), area.Width(), u32(bottom)};
+    else
+      damage.bottom = std::max<u32>(damage.bottom, bottom);
+  }
+
+  glDisable(GL_SCISSOR_TEST);
+
+  if (context_.Mode() != RendererMode::kGrid) instance_buffer_.Fence();
+
+  damaged_rows_.reset();
+  full_damage_ = false;
+
+  // Back to framebuffer coordinates
+  return Rect<u32>{area.left + damage.left, area.top + damage.top,
+                   area.left + damage.right, area.top + damage.bottom};
 }
-}  // namespace bitty
\ No newline at end of file
+}  // namespace bitty
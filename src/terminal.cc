@@ -7,8 +7,10 @@
 #include <unordered_map>
 
 #include "cell_buffer.hh"
+#include "char_width.hh"
 #include "escape_parser.hh"
 #include "font_renderer.hh"
+#include "grapheme.hh"
 #include "util.hh"
 
 namespace bitty {
@@ -81,6 +83,11 @@ bool Terminal::TryResetUserScroll() {
   return true;
 }
 
+void Terminal::RescaleUserScroll(u32 old_cell_height) {
+  normal_buf_->RescaleUserScroll(old_cell_height);
+  if (alternate_buf_) alternate_buf_->RescaleUserScroll(old_cell_height);
+}
+
 bool Terminal::IsUserScrolledUp() {
   if (buf_ != normal_buf_) return false;
 
@@ -166,10 +173,11 @@ void Terminal::ReportMouseEvent(u32 btn, bool is_down, bool is_motion, u32 mods,
 void Terminal::HandleMouseScroll(const EventMouseScroll& event) {
   int scroll_unit = GlobalCellHeightPx() * 2;
 
-  if (int scroll_px = std::round(event.offset_y); scroll_px < 0)
-    TryScrollBufferDown(-scroll_px * scroll_unit);
+  // Fractional offsets from touchpads scroll by the matching number of pixels
+  if (int scroll_px = std::round(event.offset_y * scroll_unit); scroll_px < 0)
+    TryScrollBufferDown(-scroll_px);
   else
-    TryScrollBufferUp(scroll_px * scroll_unit);
+    TryScrollBufferUp(scroll_px);
 
   if (mouse_mode_ >= MouseTrackingMode::kOnlyButtonEvents) {
     if (int oy = (int)event.offset_y; oy != 0)
@@ -247,6 +255,21 @@ int Terminal::Create(const std::string& shell_path, u32 init_w, u32 init_h) {
   }
 }
 
+int Terminal::CreateDetached(u32 init_w, u32 init_h) {
+  // Pty descriptors are never negative, so these ids cannot collide
+  static int next_id = -2;
+
+  auto term = std::shared_ptr<Terminal>(new Terminal(init_w, init_h));
+
+  int id = next_id--;
+
+  term->AssignId(id);
+
+  terminals_[id] = std::move(term);
+
+  return id;
+}
+
 void Terminal::ReportUnhandledSequence() {
 #ifdef TERM_DEBUG
   LogError() << "Unhandled ANSI escape sequence #" << esc_seq_error_counter_++
@@ -422,6 +445,9 @@ void Terminal::SetPrivateMode(u32 mode, bool flag) {
       } else
         mouse_mode_ = MouseTrackingMode::kNoTracking;
       break;
+    case 12:
+      is_cursor_blinking_ = flag;
+      break;
     case 25:
       SetCursorVisibility(flag);
       break;
@@ -550,8 +576,29 @@ void Terminal::SetRgbColor(u32 fg_or_bg, u32 r, u32 g, u32 b) {
 DEF_ESC_HANDLER(SetCharacterSet) { (void)tokens; }
 
 DEF_ESC_HANDLER(SetCursorStyleHandler) {
-  (void)tokens;
-  ReportUnhandledSequence();
+  u32 style = std::get<u32>(tokens.at(1));
+
+  // DECSCUSR: 0 and odd values blink, even values are steady
+  switch (style) {
+    case 0:
+    case 1:
+    case 2:
+      cursor_style_ = CursorStyle::kBlock;
+      break;
+    case 3:
+    case 4:
+      cursor_style_ = CursorStyle::kUnderline;
+      break;
+    case 5:
+    case 6:
+      cursor_style_ = CursorStyle::kBar;
+      break;
+    default:
+      ReportUnhandledSequence();
+      return;
+  }
+
+  is_cursor_blinking_ = style == 0 || style % 2 == 1;
 }
 
 DEF_ESC_HANDLER(ClearScreen) {
@@ -902,6 +949,35 @@ bool Terminal::Set(u32 x, u32 y, Cell chr) {
   return buf_->Set(x, y, ColoredCell(chr, current_fg_, current_bg_));
 }
 
+bool Terminal::ExtendGrapheme(char32_t codepoint) {
+  std::optional<ColoredCell> first = buf_->Get(grapheme_x_, grapheme_y_);
+
+  if (!first || first->segment_index != 0 || first->true_code != grapheme_[0])
+    return false;
+
+  // Joined emoji and flags keep the width applications count for them
+  u32 width = CodePointWidth(codepoint);
+  u32 segments = first->segment_count + width;
+
+  if (grapheme_x_ + segments > scroll_area_.right) return false;
+
+  grapheme_ += codepoint;
+
+  ColoredCell chr = *first;
+  chr.displayed_code = InternGrapheme(grapheme_);
+  chr.flags = CellFlags(chr.flags | CellFlags::kGrapheme);
+  chr.segment_count = segments;
+
+  for (u32 i = 0; i < segments; i++) {
+    chr.segment_index = i;
+    buf_->Set(grapheme_x_ + i, grapheme_y_, chr);
+  }
+
+  if (width) GoForwardX();
+
+  return true;
+}
+
 void Terminal::InterpretPtyInput(char byte) {
 #ifdef TERM_DEBUG
   static std::ofstream log("pty.log", std::ios_base::binary);
@@ -909,6 +985,9 @@ void Terminal::InterpretPtyInput(char byte) {
   log.flush();
 #endif
 
+  // Only characters continue a cluster, UTF-8 continuation bytes are >= 0x80
+  if (parsing_escape_code_ || u8(byte) < 0x20) grapheme_.clear();
+
   if (parsing_escape_code_) {
     auto res = escape_parser_.EatByte(byte);
 
@@ -987,10 +1066,15 @@ void Terminal::InterpretPtyInput(char byte) {
       }
     }
 
-    u32 segments =
-        codepoint < 256
-            ? 1
-            : FontRenderer::Get().GetCodePointWidthInCells(codepoint);
+    if (ContinuesGrapheme(grapheme_, codepoint) && ExtendGrapheme(codepoint))
+      return;
+
+    grapheme_.clear();
+
+    u32 segments = CodePointWidth(codepoint);
+
+    // Nothing to draw them over, and they must not take a cell
+    if (segments == 0) return;
 
     if (CursorX() >= scroll_area_.right) {
       if (IsAutowrapEnabled()) {
@@ -1000,14 +1084,28 @@ void Terminal::InterpretPtyInput(char byte) {
         SetCursorX(scroll_area_.right - 1);
     }
 
-    if (!dont_overwrite_with_space)
+    if (!dont_overwrite_with_space) {
       for (u32 i = 0; i < segments; i++)
         Set(CursorX() + i, CursorY(), Cell(codepoint, 0, i, segments));
 
+      grapheme_ = codepoint;
+      grapheme_x_ = CursorX();
+      grapheme_y_ = CursorY();
+    }
+
     GoForwardX();
   }
 }
 
+void Terminal::Destroy(int id) { terminals_.erase(id); }
+
+void Terminal::MarkGraphemes(std::vector<bool>& live) {
+  for (const auto& [id, terminal] : terminals_) {
+    terminal->normal_buf_->MarkGraphemes(live);
+    terminal->alternate_buf_->MarkGraphemes(live);
+  }
+}
+
 std::optional<std::shared_ptr<Terminal>> Terminal::Get(int id) {
   if (auto found = terminals_.find(id); found != terminals_.end())
     return found->second;
@@ -86,11 +86,17 @@ Terminal::Terminal(const std::string &shell_path, u32 init_w, u32 init_h) {
   });
 }
 
+Terminal::Terminal(u32 init_w, u32 init_h) : pt_master_no_(-1), event_fd_(-1) {
+  MakeBuffer(init_w, init_h);
+}
+
 void Terminal::SetWindowSize(uint32_t width, uint32_t height) {
-  struct winsize w = {};
-  w.ws_col = width;
-  w.ws_row = height;
-  ioctl(pt_master_no_, TIOCSWINSZ, &w);
+  if (pt_master_no_ != -1) {
+    struct winsize w = {};
+    w.ws_col = width;
+    w.ws_row = height;
+    ioctl(pt_master_no_, TIOCSWINSZ, &w);
+  }
 
   auto [delta_w, delta_vh] = buf_->Resize(width, height);
   cursor_y_ = std::min(cursor_y_, int(height - 1));
@@ -102,14 +108,19 @@ void Terminal::SetWindowSize(uint32_t width, uint32_t height) {
 }
 
 void Terminal::WriteToPty(std::vector<char> &&bytes) {
+  if (pt_master_no_ == -1) return;
+
   write(pt_master_no_, bytes.data(), bytes.size());
 }
 
 Terminal::~Terminal() {
+  if (pt_master_no_ == -1) return;
+
   uint64_t value = 1;
   write(event_fd_, &value, sizeof(uint64_t));
   thread_.join();
   close(event_fd_);
+  close(pt_master_no_);
 }
 
 }  // namespace bitty
@@ -2,7 +2,7 @@
 
 #include <iostream>
 
-#include "charset.hh"
+#include "glyph_atlas.hh"
 
 namespace bitty {
 bool CheckGLErrors() {
@@ -0,0 +1,308 @@
+#include "workspace.hh"
+
+#include <glad/gl.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "cell_buffer.hh"
+#include "font_renderer.hh"
+#include "util.hh"
+
+namespace bitty {
+Workspace::Workspace(RenderContext &context, std::string shell_path)
+    : context_(context), shell_path_(std::move(shell_path)) {}
+
+template <typename T>
+void Workspace::ForEachPane(LayoutNode *node, T func) {
+  if (!node) return;
+
+  if (node->IsLeaf()) {
+    func(*node->pane);
+    return;
+  }
+
+  ForEachPane(node->first.get(), func);
+  ForEachPane(node->second.get(), func);
+}
+
+std::unique_ptr<LayoutNode> Workspace::MakeLeaf(u32 width_px, u32 height_px) {
+  u32 w = std::max(1u, width_px / GlobalCellWidthPx());
+  u32 h = std::max(1u, height_px / GlobalCellHeightPx());
+
+  int id = Terminal::Create(shell_path_, w, h);
+
+  auto term = Terminal::Get(id);
+  if (!term.has_value()) return nullptr;
+
+  auto node = std::make_unique<LayoutNode>();
+  node->pane = std::make_unique<Pane>(std::move(term.value()), context_);
+  node->pane->grid_width = w;
+  node->pane->grid_height = h;
+
+  return node;
+}
+
+bool Workspace::NewTab() {
+  auto leaf = MakeLeaf(fb_width_, fb_height_);
+  if (!leaf) return false;
+
+  Tab tab;
+  tab.focused = leaf.get();
+  tab.root = std::move(leaf);
+
+  tabs_.push_back(std::move(tab));
+  active_tab_ = tabs_.size() - 1;
+  layout_generation_++;
+
+  Layout(fb_width_, fb_height_);
+
+  return true;
+}
+
+bool Workspace::SplitFocused(SplitDirection direction) {
+  if (Empty()) return false;
+
+  Tab &tab = tabs_[active_tab_];
+  LayoutNode *focused = tab.focused;
+
+  Rect<u32> area = focused->pane->area;
+
+  auto leaf = direction == SplitDirection::kHorizontal
+                  ? MakeLeaf(area.Width() / 2, area.Height())
+                  : MakeLeaf(area.Width(), area.Height() / 2);
+  if (!leaf) return false;
+
+  // The focused leaf turns into an inner node whose first child keeps the
+  // existing pane and whose second child holds the new one.
+  auto old_leaf = std::make_unique<LayoutNode>();
+  old_leaf->pane = std::move(focused->pane);
+  old_leaf->parent = focused;
+  leaf->parent = focused;
+
+  focused->direction = direction;
+  focused->first = std::move(old_leaf);
+  focused->second = std::move(leaf);
+
+  tab.focused = focused->second.get();
+  layout_generation_++;
+
+  Layout(fb_width_, fb_height_);
+
+  return true;
+}
+
+void Workspace::CloseFocused() {
+  if (Empty()) return;
+
+  Tab &tab = tabs_[active_tab_];
+  LayoutNode *focused = tab.focused;
+
+  Terminal::Destroy(focused->pane->terminal->Id());
+
+  if (LayoutNode *parent = focused->parent) {
+    // Collapse the parent into the surviving sibling.
+    std::unique_ptr<LayoutNode> sibling = parent->first.get() == focused
+                                              ? std::move(parent->second)
+                                              : std::move(parent->first);
+
+    parent->pane = std::move(sibling->pane);
+    parent->direction = sibling->direction;
+    parent->first = std::move(sibling->first);
+    parent->second = std::move(sibling->second);
+
+    if (parent->first) parent->first->parent = parent;
+    if (parent->second) parent->second->parent = parent;
+
+    LayoutNode *leaf = parent;
+    while (!leaf->IsLeaf()) leaf = leaf->first.get();
+    tab.focused = leaf;
+  } else {
+    tabs_.erase(tabs_.begin() + active_tab_);
+    if (active_tab_ >= tabs_.size() && active_tab_ > 0) active_tab_--;
+  }
+
+  layout_generation_++;
+  Layout(fb_width_, fb_height_);
+}
+
+void Workspace::CycleTab(i32 delta) {
+  if (Empty()) return;
+
+  // Hidden panes keep accumulating damage in their cell buffers, so the
+  // first render after switching only uploads what changed in the meantime.
+  i32 count = tabs_.size();
+  active_tab_ = ((i32(active_tab_) + delta) % count + count) % count;
+  layout_generation_++;
+}
+
+Pane *Workspace::FocusedPane() {
+  if (Empty()) return nullptr;
+  return tabs_[active_tab_].focused->pane.get();
+}
+
+LayoutNode *Workspace::LeafAt(u32 x, u32 y) {
+  if (Empty()) return nullptr;
+
+  LayoutNode *node = tabs_[active_tab_].root.get();
+
+  while (!node->IsLeaf()) {
+    LayoutNode *second = node->second.get();
+
+    while (!second->IsLeaf()) second = second->first.get();
+
+    Rect<u32> area = second->pane->area;
+
+    bool in_second = node->direction == SplitDirection::kHorizontal
+                         ? x >= area.left
+                         : y >= area.top;
+
+    node = in_second ? node->second.get() : node->first.get();
+  }
+
+  return node;
+}
+
+Pane *Workspace::PaneAt(u32 x, u32 y) {
+  LayoutNode *leaf = LeafAt(x, y);
+  return leaf ? leaf->pane.get() : nullptr;
+}
+
+bool Workspace::FocusPaneAt(u32 x, u32 y) {
+  LayoutNode *leaf = LeafAt(x, y);
+  if (!leaf) return false;
+
+  Tab &tab = tabs_[active_tab_];
+  bool changed = tab.focused != leaf;
+  tab.focused = leaf;
+
+  return changed;
+}
+
+bool Workspace::IsVisible(int terminal_id) {
+  if (Empty()) return false;
+
+  bool visible = false;
+
+  ForEachPane(tabs_[active_tab_].root.get(), [&](Pane &pane) {
+    visible |= pane.terminal->Id() == terminal_id;
+  });
+
+  return visible;
+}
+
+bool Workspace::HasBlinkingCursor() {
+  if (Empty()) return false;
+
+  bool blinking = false;
+
+  ForEachPane(tabs_[active_tab_].root.get(), [&](Pane &pane) {
+    blinking |=
+        pane.terminal->IsCursorVisible() && pane.terminal->IsCursorBlinking();
+  });
+
+  return blinking;
+}
+
+std::vector<Cell> Workspace::VisibleCells() {
+  std::unordered_set<Cell> cells;
+
+  if (!Empty()) {
+    ForEachPane(tabs_[active_tab_].root.get(), [&](Pane &pane) {
+      std::shared_ptr<CellBuffer> buf = pane.terminal->CurrentBuffer();
+      u32 top_row = buf->UserScrollInPixels() / GlobalCellHeightPx();
+      u32 bottom_row =
+          std::min(buf->Height(), top_row + buf->VisibleHeight() + 1);
+
+      for (u32 row = top_row; row < bottom_row; row++) {
+        const ColoredCell *cell = buf->RowData(row);
+
+        for (u32 x = 0; x < buf->Width(); x++)
+          if (cell[x].displayed_code) cells.insert(cell[x]);
+      }
+    });
+  }
+
+  return std::vector<Cell>(cells.begin(), cells.end());
+}
+
+void Workspace::LayoutNodeInto(LayoutNode *node, Rect<u32> area) {
+  if (node->IsLeaf()) {
+    Pane &pane = *node->pane;
+    pane.area = area;
+
+    u32 w = std::max(1u, area.Width() / GlobalCellWidthPx());
+    u32 h = std::max(1u, area.Height() / GlobalCellHeightPx());
+
+    if (w != pane.grid_width || h != pane.grid_height) {
+      pane.terminal->SetWindowSize(w, h);
+      pane.grid_width = w;
+      pane.grid_height = h;
+    }
+
+    return;
+  }
+
+  Rect<u32> first = area, second = area;
+
+  if (node->direction == SplitDirection::kHorizontal) {
+    u32 mid = area.left + area.Width() / 2;
+    first.right = mid;
+    second.left = mid;
+  } else {
+    u32 mid = area.top + area.Height() / 2;
+    first.bottom = mid;
+    second.top = mid;
+  }
+
+  LayoutNodeInto(node->first.get(), first);
+  LayoutNodeInto(node->second.get(), second);
+}
+
+void Workspace::Layout(u32 fb_width, u32 fb_height) {
+  fb_width_ = fb_width;
+  fb_height_ = fb_height;
+
+  for (Tab &tab : tabs_)
+    LayoutNodeInto(tab.root.get(), Rect<u32>{0, 0, fb_width, fb_height});
+}
+
+void Workspace::RelayoutCells(u32 old_cell_height) {
+  for (Tab &tab : tabs_)
+    ForEachPane(tab.root.get(), [&](Pane &pane) {
+      pane.terminal->RescaleUserScroll(old_cell_height);
+    });
+
+  Layout(fb_width_, fb_height_);
+  Invalidate();
+}
+
+void Workspace::Invalidate() {
+  if (Empty()) return;
+
+  ForEachPane(tabs_[active_tab_].root.get(),
+              [](Pane &pane) { pane.renderer.Invalidate(); });
+}
+
+void Workspace::Render(RetainedFrame &frame, bool cursor_blink_on) {
+  if (Empty()) return;
+
+  // Panes of a tab brought to the front, or of a changed layout, have to
+  // cover what the previous one left in the frame.
+  if (layout_generation_ != rendered_generation_) {
+    rendered_generation_ = layout_generation_;
+    Invalidate();
+  }
+
+  // Before any pane maps glyphs, which could evict those another one shows
+  ForEachPane(tabs_[active_tab_].root.get(),
+              [](Pane &pane) { pane.renderer.TouchResidentRows(); });
+
+  ForEachPane(tabs_[active_tab_].root.get(), [&](Pane &pane) {
+    frame.Damage(pane.renderer.Render(*pane.terminal, pane.area, fb_height_,
+                                      cursor_blink_on));
+  });
+
+  glViewport(0, 0, fb_width_, fb_height_);
+}
+}  // namespace bitty
@@ -0,0 +1,59 @@
+#include "char_width.hh"
+
+#include "check.hh"
+
+using namespace bitty;
+
+int main() {
+  // Printable ASCII, controls and Latin-1
+  for (char32_t codepoint = 0x20; codepoint < 0x7F; codepoint++)
+    CHECK(CodePointWidth(codepoint) == 1);
+
+  CHECK(CodePointWidth(0x00) == 0);
+  CHECK(CodePointWidth(0x1F) == 0);
+  CHECK(CodePointWidth(0x7F) == 0);
+  CHECK(CodePointWidth(0x9F) == 0);
+  CHECK(CodePointWidth(0xA0) == 1);
+  CHECK(CodePointWidth(0xAD) == 1);  // Soft hyphen, as wcwidth has it
+
+  // Both ends of zero width ranges
+  CHECK(CodePointWidth(0x0300) == 0);
+  CHECK(CodePointWidth(0x036F) == 0);
+  CHECK(CodePointWidth(0x0370) == 1);
+  CHECK(CodePointWidth(0x1160) == 0);  // Hangul medial vowels
+  CHECK(CodePointWidth(0x11FF) == 0);
+  CHECK(CodePointWidth(0x200D) == 0);  // Zero width joiner
+  CHECK(CodePointWidth(0xFE00) == 0);  // Variation selectors
+  CHECK(CodePointWidth(0xFE0F) == 0);
+  CHECK(CodePointWidth(0xE0001) == 0);  // Language tag
+  CHECK(CodePointWidth(0xE0100) == 0);
+  CHECK(CodePointWidth(0xE01EF) == 0);
+
+  // Both ends of wide ranges
+  CHECK(CodePointWidth(0x1100) == 2);  // Hangul initial consonants
+  CHECK(CodePointWidth(0x115F) == 2);
+  CHECK(CodePointWidth(0x3000) == 2);  // Ideographic space
+  CHECK(CodePointWidth(0x303F) == 1);
+  CHECK(CodePointWidth(0xAC00) == 2);  // Hangul syllables
+  CHECK(CodePointWidth(0xD7A3) == 2);
+  CHECK(CodePointWidth(0xD7A4) == 1);
+  CHECK(CodePointWidth(0xFF01) == 2);  // Fullwidth forms
+  CHECK(CodePointWidth(0xFF60) == 2);
+  CHECK(CodePointWidth(0xFF61) == 1);  // Halfwidth forms
+  CHECK(CodePointWidth(0x20000) == 2);  // CJK extension B
+  CHECK(CodePointWidth(0x2FFFD) == 2);
+  CHECK(CodePointWidth(0x30000) == 2);
+
+  // Emoji: wide presentation, but regional indicators are single
+  CHECK(CodePointWidth(0x1F600) == 2);
+  CHECK(CodePointWidth(0x1F3FB) == 2);  // Skin tone modifier
+  CHECK(CodePointWidth(0x1F1E6) == 1);
+
+  // Past the table, and past Unicode
+  CHECK(CodePointWidth(0x10FFFF) == 1);
+  CHECK(CodePointWidth(0x110000) == 1);
+  CHECK(CodePointWidth(0xFFFFFFFF) == 1);
+
+  for (char32_t codepoint = 0; codepoint < 0x110000; codepoint++)
+    CHECK(CodePointWidth(codepoint) <= 2);
+}
@@ -0,0 +1,39 @@
+#ifndef __BITTY_TESTS_CHECK_HH__
+#define __BITTY_TESTS_CHECK_HH__
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+// Unlike assert(), checked in Release builds too, which CMakeLists.txt sets
+#define CHECK(condition)                                                \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,       \
+                   __LINE__, #condition);                               \
+      std::exit(EXIT_FAILURE);                                          \
+    }                                                                   \
+  } while (0)
+
+namespace bitty {
+// Points $XDG_CACHE_HOME and $XDG_CONFIG_HOME at a fresh directory, so that
+// tests neither read nor clobber the caches and config of the user
+inline std::filesystem::path UseTempHome(const std::string &name) {
+  std::filesystem::path home = std::filesystem::temp_directory_path() /
+                               (name + '.' + std::to_string(getpid()));
+
+  std::filesystem::remove_all(home);
+  std::filesystem::create_directories(home / "cache");
+  std::filesystem::create_directories(home / "config");
+
+  setenv("XDG_CACHE_HOME", (home / "cache").c_str(), 1);
+  setenv("XDG_CONFIG_HOME", (home / "config").c_str(), 1);
+
+  return home;
+}
+}  // namespace bitty
+
+#endif /* __BITTY_TESTS_CHECK_HH__ */
@@ -0,0 +1,51 @@
+#include "font_cache.hh"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+#include "check.hh"
+
+using namespace bitty;
+
+int main() {
+  std::filesystem::path home = UseTempHome("bitty-font-cache-test");
+  std::filesystem::path cache_dir = home / "cache" / "bitty";
+
+  std::string font = home / "Mono.ttf";
+  std::ofstream{font} << "not really a font";
+
+  FontCache &cache = FontCache::Get();
+
+  CHECK(!cache.File("Mono:medium"));
+  cache.SetFile("Mono:medium", font);
+  CHECK(cache.File("Mono:medium") == font);
+
+  CHECK(!cache.CellWidth(font, 13 * 64));
+  cache.SetCellWidth(font, 13 * 64, 520);
+  CHECK(cache.CellWidth(font, 13 * 64) == 520);
+  CHECK(!cache.CellWidth(font, 14 * 64));
+
+  // What the next launch loads
+  {
+    std::ifstream stream{cache_dir / "fonts.json"};
+    nlohmann::json json = nlohmann::json::parse(stream);
+
+    CHECK(json["fontconfig_stamp"] == cache.FontconfigStamp());
+    CHECK(json["files"]["Mono:medium"]["file"] == font);
+    CHECK(json["cell_widths"].size() == 1);
+  }
+
+  for (const auto &file : std::filesystem::directory_iterator(cache_dir))
+    CHECK(file.path().filename() == "fonts.json");
+
+  // A font file replaced since is resolved and measured again
+  std::filesystem::last_write_time(
+      font, std::filesystem::last_write_time(font) + std::chrono::seconds(1));
+
+  CHECK(!cache.File("Mono:medium"));
+  CHECK(!cache.CellWidth(font, 13 * 64));
+
+  std::filesystem::remove_all(home);
+}
@@ -0,0 +1,62 @@
+#include "glyph_cache.hh"
+
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "check.hh"
+
+using namespace bitty;
+
+int main() {
+  std::filesystem::path home = UseTempHome("bitty-glyph-cache-test");
+
+  constexpr u64 kKey = 0x1234;
+  constexpr u32 kWidth = 3, kHeight = 5;
+
+  std::vector<u8> coverage(kWidth * kHeight), color(kWidth * kHeight * 4);
+  for (size_t i = 0; i < coverage.size(); i++) coverage[i] = i * 7;
+  for (size_t i = 0; i < color.size(); i++) color[i] = 255 - i;
+
+  Cell wide('W', CellFlags::kBold, 1, 2);
+  Cell substituted('a', 0);
+  substituted.displayed_code = 0x1F600;
+
+  std::vector<GlyphCache::Entry> entries = {
+      {wide, false, coverage.data()},
+      {substituted, true, color.data()},
+  };
+
+  CHECK(GlyphCache::Write(kKey, kWidth, kHeight, entries));
+
+  {
+    GlyphCache cache(kKey, kWidth, kHeight);
+    const auto &loaded = cache.Entries();
+
+    CHECK(loaded.size() == entries.size());
+
+    for (size_t i = 0; i < loaded.size(); i++) {
+      CHECK(loaded[i].chr == entries[i].chr);
+      CHECK(loaded[i].color == entries[i].color);
+    }
+
+    CHECK(!std::memcmp(loaded[0].tile, coverage.data(), coverage.size()));
+    CHECK(!std::memcmp(loaded[1].tile, color.data(), color.size()));
+  }
+
+  // Another font or cell size finds nothing
+  CHECK(GlyphCache(kKey + 1, kWidth, kHeight).Entries().empty());
+  CHECK(GlyphCache(kKey, kWidth + 1, kHeight).Entries().empty());
+
+  // The temporary file was renamed into place
+  for (const auto &file : std::filesystem::directory_iterator(
+           GlyphCache::Path().parent_path()))
+    CHECK(file.path() == GlyphCache::Path());
+
+  // A truncated file still gives the glyphs before the cut
+  std::filesystem::resize_file(
+      GlyphCache::Path(), std::filesystem::file_size(GlyphCache::Path()) - 1);
+  CHECK(GlyphCache(kKey, kWidth, kHeight).Entries().size() == 1);
+
+  std::filesystem::remove_all(home);
+}
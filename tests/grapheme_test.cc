@@ -0,0 +1,148 @@
+#include "grapheme.hh"
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cell_buffer.hh"
+#include "check.hh"
+#include "terminal.hh"
+
+using namespace bitty;
+
+namespace {
+std::shared_ptr<Terminal> NewTerminal() {
+  return Terminal::Get(Terminal::CreateDetached(20, 4)).value();
+}
+
+void Feed(Terminal &terminal, std::string_view bytes) {
+  for (char byte : bytes) terminal.InterpretPtyInput(byte);
+}
+
+Cell At(Terminal &terminal, u32 x, u32 y = 0) {
+  return terminal.CurrentBuffer()->Get(x, y).value();
+}
+
+// The codepoints of the grapheme cell at x, y
+std::u32string TextAt(Terminal &terminal, u32 x, u32 y = 0) {
+  Cell chr = At(terminal, x, y);
+  CHECK(chr.flags & CellFlags::kGrapheme);
+
+  return FindGrapheme(chr.displayed_code).value_or(U"");
+}
+}  // namespace
+
+int main() {
+  std::filesystem::path home = UseTempHome("bitty-grapheme-test");
+
+  // A letter and its combining mark share one cell
+  {
+    auto terminal = NewTerminal();
+    Feed(*terminal, "e\u0301x");
+
+    CHECK(TextAt(*terminal, 0) == U"e\u0301");
+    CHECK(At(*terminal, 0).true_code == U'e');
+    CHECK(At(*terminal, 0).segment_count == 1);
+    CHECK(At(*terminal, 1).displayed_code == U'x');
+    CHECK(terminal->CursorX() == 2);
+  }
+
+  // The same text gets the same id
+  {
+    auto terminal = NewTerminal();
+    Feed(*terminal, "e\u0301e\u0301");
+
+    CHECK(At(*terminal, 0).displayed_code == At(*terminal, 1).displayed_code);
+  }
+
+  // A flag is a pair of regional indicators over two cells
+  {
+    auto terminal = NewTerminal();
+    Feed(*terminal, "\U0001F1EB\U0001F1F7\U0001F1E9");
+
+    CHECK(TextAt(*terminal, 0) == U"\U0001F1EB\U0001F1F7");
+    CHECK(At(*terminal, 1).displayed_code == At(*terminal, 0).displayed_code);
+    CHECK(At(*terminal, 1).segment_index == 1);
+    CHECK(At(*terminal, 1).segment_count == 2);
+    // A third indicator starts another flag
+    CHECK(At(*terminal, 2).displayed_code == U'\U0001F1E9');
+  }
+
+  // Emoji joined with ZWJ keep the width of each emoji
+  {
+    auto terminal = NewTerminal();
+    Feed(*terminal, "\U0001F468\u200D\U0001F469\u200D\U0001F467");
+
+    std::u32string family = U"\U0001F468\u200D\U0001F469\u200D\U0001F467";
+    CHECK(TextAt(*terminal, 0) == family);
+    CHECK(At(*terminal, 0).segment_count == 6);
+    CHECK(TextAt(*terminal, 5) == family);
+    CHECK(terminal->CursorX() == 6);
+  }
+
+  // Anything but a character ends the cluster
+  {
+    auto terminal = NewTerminal();
+    Feed(*terminal, "ab\r\u0301");
+
+    CHECK(At(*terminal, 0).displayed_code == U'a');
+    CHECK(At(*terminal, 1).displayed_code == U'b');
+    CHECK(terminal->CursorX() == 0);
+  }
+
+  // A cell overwritten since is not extended
+  {
+    auto terminal = NewTerminal();
+    Feed(*terminal, "a\rb\u0301");
+
+    CHECK(TextAt(*terminal, 0) == U"b\u0301");
+  }
+
+  // Sweeps free what no cell holds, and hand the ids out again
+  {
+    auto terminal = NewTerminal();
+    Feed(*terminal, "o\u0308\r\n");
+
+    u32 kept = At(*terminal, 0).displayed_code;
+
+    // A letter with two of the combining marks at U+0300, each two bytes of
+    // UTF-8, over and over the same cell
+    for (u32 i = 0; !GraphemeSweepDue(); i++) {
+      std::string bytes = "\ra";
+
+      for (u32 mark : {0x300 + i % 0x70, 0x300 + i / 0x70 % 0x70}) {
+        bytes += char(0xC0 | mark >> 6);
+        bytes += char(0x80 | (mark & 0x3F));
+      }
+
+      Feed(*terminal, bytes);
+    }
+
+    u32 last = At(*terminal, 0, 1).displayed_code;
+    std::u32string last_text = TextAt(*terminal, 0, 1);
+
+    std::vector<bool> live;
+    Terminal::MarkGraphemes(live);
+    std::vector<u32> freed = SweepGraphemes(live);
+
+    CHECK(!GraphemeSweepDue());
+    CHECK(freed.size() > 1000);
+    CHECK(TextAt(*terminal, 0) == U"o\u0308");
+    CHECK(At(*terminal, 0).displayed_code == kept);
+    CHECK(TextAt(*terminal, 0, 1) == last_text);
+
+    for (u32 id : freed) {
+      CHECK(id != kept && id != last);
+      CHECK(!FindGrapheme(id));
+    }
+
+    u32 reused = InternGrapheme(U"u\u0308");
+    CHECK(std::find(freed.begin(), freed.end(), reused) != freed.end());
+    CHECK(FindGrapheme(reused) == U"u\u0308");
+  }
+
+  std::filesystem::remove_all(home);
+}
@@ -0,0 +1,79 @@
+#include "shaper.hh"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "check.hh"
+
+using namespace bitty;
+
+namespace {
+// Glyph ids equal codepoints in this font
+u32 Nominal(char32_t codepoint) { return codepoint; }
+
+// Unhinted advance of a 600 unit glyph at 13 pt, not a whole pixel
+constexpr i32 kAdvance = 10 * 64 + 27;
+
+ShapedGlyph Glyph(u32 glyph, u32 cluster, i32 x_offset = 0, i32 y_offset = 0) {
+  return ShapedGlyph{glyph, cluster, kAdvance, x_offset, y_offset};
+}
+}  // namespace
+
+int main() {
+  // The font's own glyphs stay cells, whatever their advance
+  CHECK(ChangedCharacters(U"abc",
+                          {Glyph('a', 0), Glyph('b', 1), Glyph('c', 2)},
+                          Nominal)
+            .empty());
+
+  // A ligature of two characters
+  CHECK(ChangedCharacters(U"a=>b",
+                          {Glyph('a', 0), Glyph(1000, 1), Glyph('b', 3)},
+                          Nominal) ==
+        std::vector<bool>({false, true, true, false}));
+
+  // A contextual alternate, one glyph per character
+  CHECK(ChangedCharacters(U"xyz",
+                          {Glyph('x', 0), Glyph(1001, 1), Glyph('z', 2)},
+                          Nominal) ==
+        std::vector<bool>({false, true, false}));
+
+  // A glyph moved off its cell
+  CHECK(ChangedCharacters(U"ab", {Glyph('a', 0), Glyph('b', 1, 0, 64)},
+                          Nominal) == std::vector<bool>({false, true}));
+
+  // A ligature drawn as a spacer and a glyph over both cells
+  CHECK(ChangedCharacters(U"==", {Glyph(1002, 0), Glyph(1003, 0, -kAdvance)},
+                          Nominal) == std::vector<bool>({true, true}));
+
+  // Right to left runs are left alone
+  CHECK(ChangedCharacters(U"ab", {Glyph('b', 1), Glyph('a', 0)}, Nominal)
+            .empty());
+
+  // Sweeps free the clusters nothing marked, and hand the ids out again
+  {
+    u32 kept = InternGlyphCluster({false, 2, {{1000, 0, 0}}});
+    CHECK(InternGlyphCluster({false, 2, {{1000, 0, 0}}}) == kept);
+
+    for (u32 glyph = 2000; !GlyphClusterSweepDue(); glyph++)
+      InternGlyphCluster({true, 2, {{glyph, 0, 0}}});
+
+    std::vector<bool> live(kept + 1);
+    live[kept] = true;
+    std::vector<u32> freed = SweepGlyphClusters(live);
+
+    CHECK(!GlyphClusterSweepDue());
+    CHECK(freed.size() >= 4095);
+    CHECK(FindGlyphCluster(kept)->glyphs[0].glyph == 1000);
+
+    for (u32 id : freed) {
+      CHECK(id != kept);
+      CHECK(!FindGlyphCluster(id));
+    }
+
+    u32 reused = InternGlyphCluster({false, 3, {{1001, 0, 0}}});
+    CHECK(std::find(freed.begin(), freed.end(), reused) != freed.end());
+    CHECK(FindGlyphCluster(reused)->cells == 3);
+  }
+}
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Generates include/char_width_table.hh, the cell widths of every codepoint.
+
+The widths follow what wcwidth implementations expect: East Asian Wide and
+Fullwidth characters take two cells, combining marks, format characters and
+the Hangul jamo that attach to a preceding syllable take none, and
+everything else takes one.
+
+The data comes from the Unicode database Python was built with, whose
+version is written into the header. Run it again with a newer Python to
+update the tables:
+
+    python3 tools/gen_char_width.py > include/char_width_table.hh
+"""
+
+import unicodedata
+
+BLOCK_BITS = 8
+BLOCK_SIZE = 1 << BLOCK_BITS
+WIDTHS_PER_BYTE = 4
+CODEPOINTS = 0x110000
+
+# Unassigned codepoints in these ranges are reserved for ideographs and
+# default to Wide in EastAsianWidth.txt
+WIDE_RESERVED = [
+    (0x3400, 0x4DBF),
+    (0x4E00, 0x9FFF),
+    (0xF900, 0xFAFF),
+    (0x20000, 0x2FFFD),
+    (0x30000, 0x3FFFD),
+]
+
+# Format characters that are visible, as wcwidth draws them
+VISIBLE_FORMAT = {0x00AD, 0x0600, 0x0601, 0x0602, 0x0603, 0x0604, 0x0605,
+                  0x06DD, 0x070F, 0x0890, 0x0891, 0x08E2, 0x110BD, 0x110CD}
+
+
+def width(cp):
+    char = chr(cp)
+    category = unicodedata.category(char)
+
+    if category in ("Mn", "Me", "Cc") or \
+            (category == "Cf" and cp not in VISIBLE_FORMAT):
+        return 0
+
+    # Medial vowels and final consonants of conjoining Hangul
+    if 0x1160 <= cp <= 0x11FF or 0xD7B0 <= cp <= 0xD7FF:
+        return 0
+
+    # Python's database has no width for unassigned codepoints
+    if category == "Cn":
+        return 2 if any(lo <= cp <= hi for lo, hi in WIDE_RESERVED) else 1
+
+    return 2 if unicodedata.east_asian_width(char) in ("W", "F") else 1
+
+
+def main():
+    blocks, block_ids, index = [], {}, []
+
+    for start in range(0, CODEPOINTS, BLOCK_SIZE):
+        packed = bytearray(BLOCK_SIZE // WIDTHS_PER_BYTE)
+
+        for cp in range(start, start + BLOCK_SIZE):
+            offset = cp - start
+            packed[offset // WIDTHS_PER_BYTE] |= \
+                width(cp) << (offset % WIDTHS_PER_BYTE * 2)
+
+        packed = bytes(packed)
+
+        if packed not in block_ids:
+            block_ids[packed] = len(blocks)
+            blocks.append(packed)
+
+        index.append(block_ids[packed])
+
+    assert len(blocks) <= 256
+
+    out = []
+    out.append("// Generated by tools/gen_char_width.py from Unicode %s, do not "
+               "edit" % unicodedata.unidata_version)
+    out.append("#ifndef __BITTY_CHAR_WIDTH_TABLE_HH__")
+    out.append("#define __BITTY_CHAR_WIDTH_TABLE_HH__")
+    out.append("")
+    out.append("#include <array>")
+    out.append("#include <cstdint>")
+    out.append("")
+    out.append("namespace bitty::char_width {")
+    out.append("constexpr unsigned kBlockBits = %d;" % BLOCK_BITS)
+    out.append("")
+    out.append("// Block of each group of 2^kBlockBits codepoints")
+    out.append("constexpr std::array<uint8_t, %d> kBlockIndex = {" % len(index))
+    for i in range(0, len(index), 16):
+        out.append("    " + ", ".join("%d" % b for b in index[i:i + 16]) + ",")
+    out.append("};")
+    out.append("")
+    out.append("// Widths of the codepoints in each block, four per byte, the "
+               "first in the")
+    out.append("// low bits")
+    out.append("constexpr std::array<uint8_t, %d> kBlocks = {" %
+               (len(blocks) * len(blocks[0])))
+    for block_id, block in enumerate(blocks):
+        out.append("    // %d" % block_id)
+        for i in range(0, len(block), 12):
+            out.append("    " + ", ".join("0x%02x" % b for b in block[i:i + 12])
+                       + ",")
+    out.append("};")
+    out.append("}  // namespace bitty::char_width")
+    out.append("")
+    out.append("#endif /* __BITTY_CHAR_WIDTH_TABLE_HH__ */")
+
+    print("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()